@@ -0,0 +1,50 @@
+#include "arena.h"
+
+using namespace std;
+
+Arena::Arena(size_t blockSize)
+    : m_blockSize(blockSize),
+      m_current(NULL),
+      m_offset(0),
+      m_capacity(0),
+      m_used(0)
+{
+}
+
+Arena::~Arena()
+{
+    release();
+}
+
+void* Arena::allocate(size_t size, size_t alignment)
+{
+    size_t offset = (m_offset + alignment - 1) & ~(alignment - 1);
+    if (m_current == NULL || offset + size > m_capacity) {
+        // blocks come from operator new, which is aligned for any type
+        m_capacity = size > m_blockSize ? size : m_blockSize;
+        m_current = new char[m_capacity];
+        m_blocks.push_back(m_current);
+        offset = 0;
+    }
+
+    m_offset = offset + size;
+    m_used += size;
+
+    return m_current + offset;
+}
+
+void Arena::release()
+{
+    for (vector<char*>::iterator block = m_blocks.begin();
+         block != m_blocks.end();
+         block++) {
+
+        delete[] *block;
+    }
+
+    m_blocks.clear();
+    m_current = NULL;
+    m_offset = 0;
+    m_capacity = 0;
+    m_used = 0;
+}
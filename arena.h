@@ -0,0 +1,40 @@
+#ifndef __ARENA_H_
+#define __ARENA_H_
+
+#include <cstddef>
+#include <vector>
+
+// A bump allocator handing out memory from large blocks. Allocations are
+// never freed one by one; release() returns all of them at once. Objects
+// placed in an arena must not need their destructors to run.
+class Arena {
+public:
+    Arena(size_t blockSize = 1 << 20);
+    ~Arena();
+
+    void* allocate(size_t size, size_t alignment);
+
+    template<class T>
+    T* allocate(size_t count) {
+        return static_cast<T*>(allocate(count * sizeof(T), alignof(T)));
+    }
+
+    // return all memory handed out by this arena
+    void release();
+
+    // number of bytes handed out since the last release
+    inline size_t used() const { return m_used; }
+
+private:
+    Arena(const Arena&);
+    Arena& operator=(const Arena&);
+
+    size_t m_blockSize;
+    std::vector<char*> m_blocks;
+    char* m_current;
+    size_t m_offset;
+    size_t m_capacity;
+    size_t m_used;
+};
+
+#endif // __ARENA_H_
@@ -0,0 +1,639 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+
+#include "atmosphere.h"
+#include "hash.h"
+
+using namespace std;
+
+// steps of the integrals along rays when filling the tables
+#define TRANSMITTANCE_STEPS 200
+#define SCATTERING_STEPS 32
+#define MULTIPLE_SCATTERING_STEPS 20
+#define MULTIPLE_SCATTERING_DIRECTIONS 64
+
+// the lowest sun the scattering table holds, below which the sun is
+// hidden by the planet for every point of the atmosphere
+#define MIN_MU_S -0.2
+
+// changed whenever the layout or the meaning of the tables changes, to
+// leave behind the files of older versions
+#define ATMOSPHERE_CACHE_VERSION 1
+
+static inline double clampCosine(double mu)
+{
+    return max(-1.0, min(1.0, mu));
+}
+
+static inline Color toColor(const vec3& v)
+{
+    return Color(v.x(), v.y(), v.z());
+}
+
+static inline vec3 expNegative(const vec3& v)
+{
+    return vec3(exp(-v.x()), exp(-v.y()), exp(-v.z()));
+}
+
+// a over b per channel, at most 1, which is what a ratio of transmittances
+// can be
+static inline vec3 transmittanceRatio(const vec3& a, const vec3& b)
+{
+    return vec3(b.x() > 0 ? min(1.0, a.x() / b.x()) : 0.0,
+                b.y() > 0 ? min(1.0, a.y() / b.y()) : 0.0,
+                b.z() > 0 ? min(1.0, a.z() / b.z()) : 0.0);
+}
+
+// the color at (x, y) in [0, 1]^2 of a table of width x height colors,
+// interpolated between its nodes
+static vec3 bilinear(const vector<float>& table, int width, int height, double x, double y)
+{
+    double fx = max(0.0, min(1.0, x)) * (width - 1),
+           fy = max(0.0, min(1.0, y)) * (height - 1);
+    int x0 = min((int)fx, width - 2), y0 = min((int)fy, height - 2);
+    double wx = fx - x0, wy = fy - y0;
+
+    vec3 result;
+    for (int j = 0; j < 2; j++) {
+        for (int i = 0; i < 2; i++) {
+            const float* node = &table[((y0 + j) * width + x0 + i) * 3];
+            double w = (i ? wx : 1.0 - wx) * (j ? wy : 1.0 - wy);
+            result += w * vec3(node[0], node[1], node[2]);
+        }
+    }
+    return result;
+}
+
+static double rayleighPhase(double nu)
+{
+    return 3.0 / (16.0 * M_PI) * (1.0 + nu * nu);
+}
+
+static double miePhase(double nu, double g)
+{
+    double k = 3.0 / (8.0 * M_PI) * (1.0 - g * g) / (2.0 + g * g);
+    return k * (1.0 + nu * nu) / pow(1.0 + g * g - 2.0 * g * nu, 1.5);
+}
+
+AtmosphereParameters::AtmosphereParameters()
+    : groundRadius(6360.0),
+      topRadius(6420.0),
+      rayleighScattering(5.802e-3, 13.558e-3, 33.1e-3),
+      rayleighScaleHeight(8.0),
+      mieScattering(3.996e-3),
+      mieExtinction(4.440e-3),
+      mieScaleHeight(1.2),
+      mieAnisotropy(0.8),
+      groundAlbedo(0.3)
+{
+}
+
+// fills a row of the transmittance table, by radius
+class Atmosphere::TransmittanceTask : public Task {
+public:
+    TransmittanceTask(Atmosphere& atmosphere) : m_atmosphere(atmosphere) {}
+
+    virtual void run(int row);
+
+private:
+    Atmosphere& m_atmosphere;
+};
+
+void Atmosphere::TransmittanceTask::run(int row)
+{
+    const AtmosphereParameters& p = m_atmosphere.m_parameters;
+    double g = p.groundRadius, top = p.topRadius;
+    double H = sqrt(top * top - g * g);
+
+    double rho = H * row / (TRANSMITTANCE_R - 1.0);
+    double r = sqrt(rho * rho + g * g);
+    for (int i = 0; i < TRANSMITTANCE_MU; i++) {
+        // the distance to the top, from the shortest one straight up to the
+        // longest one along the horizon
+        double dMin = top - r, dMax = rho + H;
+        double d = dMin + (dMax - dMin) * i / (TRANSMITTANCE_MU - 1.0);
+        double mu = d == 0.0 ? 1.0 : clampCosine((H * H - rho * rho - d * d) / (2.0 * r * d));
+
+        double rayleigh = 0.0, mie = 0.0;
+        double dx = d / TRANSMITTANCE_STEPS;
+        for (int k = 0; k <= TRANSMITTANCE_STEPS; k++) {
+            double t = k * dx;
+            double rt = sqrt(t * t + 2.0 * r * mu * t + r * r);
+            double w = k == 0 || k == TRANSMITTANCE_STEPS ? 0.5 : 1.0;
+            rayleigh += w * m_atmosphere.rayleighDensity(rt);
+            mie += w * m_atmosphere.mieDensity(rt);
+        }
+
+        vec3 depth = (rayleigh * dx) * p.rayleighScattering
+                   + vec3(1.0, 1.0, 1.0) * (mie * dx * p.mieExtinction);
+        vec3 transmittance = expNegative(depth);
+
+        float* node = &m_atmosphere.m_transmittance[(row * TRANSMITTANCE_MU + i) * 3];
+        node[0] = transmittance.x();
+        node[1] = transmittance.y();
+        node[2] = transmittance.z();
+    }
+}
+
+// fills a row of the table of light scattered more than once, by radius
+class Atmosphere::MultipleScatteringTask : public Task {
+public:
+    MultipleScatteringTask(Atmosphere& atmosphere) : m_atmosphere(atmosphere) {}
+
+    virtual void run(int row);
+
+private:
+    Atmosphere& m_atmosphere;
+};
+
+void Atmosphere::MultipleScatteringTask::run(int row)
+{
+    const Atmosphere& a = m_atmosphere;
+    const AtmosphereParameters& p = a.m_parameters;
+    double g = p.groundRadius, top = p.topRadius;
+    double r = g + (top - g) * row / (MULTIPLE_SCATTERING_SIZE - 1.0);
+    vec3 x(0.0, 0.0, r);
+
+    for (int i = 0; i < MULTIPLE_SCATTERING_SIZE; i++) {
+        double muS = -1.0 + 2.0 * i / (MULTIPLE_SCATTERING_SIZE - 1.0);
+        vec3 sun(sqrt(max(0.0, 1.0 - muS * muS)), 0.0, muS);
+
+        // the light scattered twice towards x, from directions spread evenly
+        // over the sphere, and the share of any light that is scattered
+        // back again. both are averages over the sphere, which is what the
+        // isotropic phase function makes of their integrals.
+        vec3 secondOrder, transfer;
+        for (int k = 0; k < MULTIPLE_SCATTERING_DIRECTIONS; k++) {
+            double z = 1.0 - (2.0 * k + 1.0) / MULTIPLE_SCATTERING_DIRECTIONS;
+            double phi = k * M_PI * (3.0 - sqrt(5.0));
+            double s = sqrt(max(0.0, 1.0 - z * z));
+            vec3 direction(s * cos(phi), s * sin(phi), z);
+
+            double mu = z;
+            bool ground = a.hitsGround(r, mu);
+            double distance = ground ? a.distanceToGround(r, mu) : a.distanceToTop(r, mu);
+            double dt = distance / MULTIPLE_SCATTERING_STEPS;
+            for (int j = 0; j < MULTIPLE_SCATTERING_STEPS; j++) {
+                double t = (j + 0.5) * dt;
+                vec3 y = x + t * direction;
+                double ry = y.abs();
+                vec3 scattering = a.rayleighDensity(ry) * p.rayleighScattering
+                                + vec3(1.0, 1.0, 1.0) * (a.mieDensity(ry) * p.mieScattering);
+                vec3 view = a.transmittance(r, mu, t, ground);
+                vec3 sunlight = a.sunTransmittance(ry, clampCosine(y.dot(sun) / ry));
+                secondOrder += dt * view.mul(scattering).mul(sunlight);
+                transfer += dt * view.mul(scattering);
+            }
+
+            if (ground) {
+                vec3 y = x + distance * direction;
+                double muG = clampCosine(y.dot(sun) / y.abs());
+                vec3 view = a.transmittance(r, mu, distance, ground);
+                vec3 sunlight = a.sunTransmittance(g, muG);
+                secondOrder += (p.groundAlbedo / M_PI * max(muG, 0.0)) * view.mul(sunlight);
+            }
+        }
+        secondOrder /= MULTIPLE_SCATTERING_DIRECTIONS;
+        transfer /= MULTIPLE_SCATTERING_DIRECTIONS;
+
+        // every order scatters the same share of the one before, which sums
+        // to a geometric series
+        float* node = &m_atmosphere.m_multipleScattering[(row * MULTIPLE_SCATTERING_SIZE + i) * 3];
+        node[0] = secondOrder.x() / (1.0 - transfer.x());
+        node[1] = secondOrder.y() / (1.0 - transfer.y());
+        node[2] = secondOrder.z() / (1.0 - transfer.z());
+    }
+}
+
+// fills the scattering table for one radius and view angle
+class Atmosphere::ScatteringTask : public Task {
+public:
+    ScatteringTask(Atmosphere& atmosphere) : m_atmosphere(atmosphere) {}
+
+    virtual void run(int index);
+
+private:
+    Atmosphere& m_atmosphere;
+};
+
+void Atmosphere::ScatteringTask::run(int index)
+{
+    const Atmosphere& a = m_atmosphere;
+    const AtmosphereParameters& p = a.m_parameters;
+    int ir = index / SCATTERING_MU, imu = index % SCATTERING_MU;
+
+    for (int imuS = 0; imuS < SCATTERING_MU_S; imuS++) {
+        for (int inu = 0; inu < SCATTERING_NU; inu++) {
+            double r, mu, muS, nu;
+            bool ground;
+            a.scatteringNode(ir, imu, imuS, inu, r, mu, muS, nu, ground);
+
+            // single scattering along the ray up to the ground or the top,
+            // and the light scattered more than once at every point of it
+            double distance = ground ? a.distanceToGround(r, mu) : a.distanceToTop(r, mu);
+            double dt = distance / SCATTERING_STEPS;
+            vec3 rayleigh, mie, multiple;
+            for (int k = 0; k <= SCATTERING_STEPS; k++) {
+                double t = k * dt;
+                double w = k == 0 || k == SCATTERING_STEPS ? 0.5 : 1.0;
+                double rt = max(p.groundRadius,
+                                min(p.topRadius, sqrt(t * t + 2.0 * r * mu * t + r * r)));
+                double muSt = clampCosine((r * muS + t * nu) / rt);
+
+                vec3 view = a.transmittance(r, mu, t, ground);
+                vec3 lit = view.mul(a.sunTransmittance(rt, muSt));
+                rayleigh += (w * a.rayleighDensity(rt)) * lit;
+                mie += (w * a.mieDensity(rt)) * lit;
+
+                vec3 scattering = a.rayleighDensity(rt) * p.rayleighScattering
+                                + vec3(1.0, 1.0, 1.0) * (a.mieDensity(rt) * p.mieScattering);
+                multiple += w * view.mul(scattering).mul(a.multipleScattering(rt, muSt));
+            }
+            rayleigh = dt * rayleigh.mul(p.rayleighScattering);
+            mie = (dt * p.mieScattering) * mie;
+            multiple = dt * multiple;
+
+            size_t node = ((((size_t)ir * SCATTERING_MU + imu) * SCATTERING_MU_S + imuS)
+                           * SCATTERING_NU + inu) * SCATTERING_VALUES;
+            float* values = &m_atmosphere.m_scattering[node];
+            values[RAYLEIGH + 0] = rayleigh.x();
+            values[RAYLEIGH + 1] = rayleigh.y();
+            values[RAYLEIGH + 2] = rayleigh.z();
+            values[MIE + 0] = mie.x();
+            values[MIE + 1] = mie.y();
+            values[MIE + 2] = mie.z();
+            values[MULTIPLE + 0] = multiple.x();
+            values[MULTIPLE + 1] = multiple.y();
+            values[MULTIPLE + 2] = multiple.z();
+        }
+    }
+}
+
+Atmosphere::Atmosphere(const AtmosphereParameters& parameters)
+    : m_parameters(parameters)
+{
+}
+
+void Atmosphere::compute(WorkerPool& pool)
+{
+    // each table is read by the next
+    m_transmittance.assign(TRANSMITTANCE_R * TRANSMITTANCE_MU * 3, 0.0f);
+    TransmittanceTask transmittance(*this);
+    pool.run(transmittance, TRANSMITTANCE_R);
+
+    m_multipleScattering.assign(MULTIPLE_SCATTERING_SIZE * MULTIPLE_SCATTERING_SIZE * 3, 0.0f);
+    MultipleScatteringTask multipleScattering(*this);
+    pool.run(multipleScattering, MULTIPLE_SCATTERING_SIZE);
+
+    m_scattering.assign((size_t)SCATTERING_R * SCATTERING_MU * SCATTERING_MU_S * SCATTERING_NU
+                        * SCATTERING_VALUES,
+                        0.0f);
+    ScatteringTask scattering(*this);
+    pool.run(scattering, SCATTERING_R * SCATTERING_MU);
+}
+
+unsigned long long Atmosphere::key() const
+{
+    const AtmosphereParameters& p = m_parameters;
+    unsigned long long hash = HASH_SEED;
+    hash = hashValue(hash, (double)ATMOSPHERE_CACHE_VERSION);
+    hash = hashValue(hash, p.groundRadius);
+    hash = hashValue(hash, p.topRadius);
+    hash = hashValue(hash, p.rayleighScattering);
+    hash = hashValue(hash, p.rayleighScaleHeight);
+    hash = hashValue(hash, p.mieScattering);
+    hash = hashValue(hash, p.mieExtinction);
+    hash = hashValue(hash, p.mieScaleHeight);
+    hash = hashValue(hash, p.mieAnisotropy);
+    hash = hashValue(hash, p.groundAlbedo);
+
+    // and the layout of the tables
+    hash = hashValue(hash, (double)TRANSMITTANCE_MU);
+    hash = hashValue(hash, (double)TRANSMITTANCE_R);
+    hash = hashValue(hash, (double)SCATTERING_R);
+    hash = hashValue(hash, (double)SCATTERING_MU);
+    hash = hashValue(hash, (double)SCATTERING_MU_S);
+    hash = hashValue(hash, (double)SCATTERING_NU);
+    hash = hashValue(hash, (double)MULTIPLE_SCATTERING_SIZE);
+    return hash;
+}
+
+string Atmosphere::cacheFile(const string& directory) const
+{
+    char name[64];
+    sprintf(name, "atmosphere-%016llx.lut", key());
+    return directory + "/" + name;
+}
+
+bool Atmosphere::load(const string& directory)
+{
+    FILE* fh = fopen(cacheFile(directory).c_str(), "rb");
+    if (fh == NULL) {
+        return false;
+    }
+
+    vector<float> transmittance(TRANSMITTANCE_R * TRANSMITTANCE_MU * 3);
+    vector<float> multipleScattering(MULTIPLE_SCATTERING_SIZE * MULTIPLE_SCATTERING_SIZE * 3);
+    vector<float> scattering((size_t)SCATTERING_R * SCATTERING_MU * SCATTERING_MU_S
+                             * SCATTERING_NU * SCATTERING_VALUES);
+
+    unsigned long long fileKey = 0;
+    bool complete = fread(&fileKey, sizeof(fileKey), 1, fh) == 1
+                 && fileKey == key()
+                 && fread(&transmittance[0], sizeof(float), transmittance.size(), fh)
+                        == transmittance.size()
+                 && fread(&multipleScattering[0], sizeof(float), multipleScattering.size(), fh)
+                        == multipleScattering.size()
+                 && fread(&scattering[0], sizeof(float), scattering.size(), fh)
+                        == scattering.size();
+    fclose(fh);
+
+    if (!complete) {
+        return false;
+    }
+
+    m_transmittance.swap(transmittance);
+    m_multipleScattering.swap(multipleScattering);
+    m_scattering.swap(scattering);
+    return true;
+}
+
+bool Atmosphere::save(const string& directory) const
+{
+    FILE* fh = fopen(cacheFile(directory).c_str(), "wb");
+    if (fh == NULL) {
+        return false;
+    }
+
+    unsigned long long fileKey = key();
+    bool complete = fwrite(&fileKey, sizeof(fileKey), 1, fh) == 1
+                 && fwrite(&m_transmittance[0], sizeof(float), m_transmittance.size(), fh)
+                        == m_transmittance.size()
+                 && fwrite(&m_multipleScattering[0], sizeof(float), m_multipleScattering.size(), fh)
+                        == m_multipleScattering.size()
+                 && fwrite(&m_scattering[0], sizeof(float), m_scattering.size(), fh)
+                        == m_scattering.size();
+    return fclose(fh) == 0 && complete;
+}
+
+double Atmosphere::distanceToTop(double r, double mu) const
+{
+    double top = m_parameters.topRadius;
+    return max(0.0, -r * mu + sqrt(max(0.0, r * r * (mu * mu - 1.0) + top * top)));
+}
+
+double Atmosphere::distanceToGround(double r, double mu) const
+{
+    double g = m_parameters.groundRadius;
+    return max(0.0, -r * mu - sqrt(max(0.0, r * r * (mu * mu - 1.0) + g * g)));
+}
+
+bool Atmosphere::hitsGround(double r, double mu) const
+{
+    double g = m_parameters.groundRadius;
+    return mu < 0.0 && r * r * (mu * mu - 1.0) + g * g >= 0.0;
+}
+
+double Atmosphere::rayleighDensity(double r) const
+{
+    return exp(-(r - m_parameters.groundRadius) / m_parameters.rayleighScaleHeight);
+}
+
+double Atmosphere::mieDensity(double r) const
+{
+    return exp(-(r - m_parameters.groundRadius) / m_parameters.mieScaleHeight);
+}
+
+Color Atmosphere::transmittanceToTop(double r, double mu) const
+{
+    double g = m_parameters.groundRadius, top = m_parameters.topRadius;
+    double H = sqrt(top * top - g * g);
+    r = max(g, min(top, r));
+    double rho = sqrt(max(0.0, r * r - g * g));
+
+    double dMin = top - r, dMax = rho + H;
+    double x = dMax > dMin ? (distanceToTop(r, mu) - dMin) / (dMax - dMin) : 0.0;
+    return toColor(bilinear(m_transmittance, TRANSMITTANCE_MU, TRANSMITTANCE_R, x, rho / H));
+}
+
+Color Atmosphere::transmittance(double r, double mu, double d, bool ground) const
+{
+    double g = m_parameters.groundRadius, top = m_parameters.topRadius;
+    double rd = max(g, min(top, sqrt(d * d + 2.0 * r * mu * d + r * r)));
+    double muD = clampCosine((r * mu + d) / rd);
+
+    // the table only holds transmittances to the top, so a ray towards the
+    // ground is taken in reverse, from its end
+    if (ground) {
+        return toColor(transmittanceRatio(transmittanceToTop(rd, -muD), transmittanceToTop(r, -mu)));
+    }
+    return toColor(transmittanceRatio(transmittanceToTop(r, mu), transmittanceToTop(rd, muD)));
+}
+
+Color Atmosphere::sunTransmittance(double r, double muS) const
+{
+    if (hitsGround(r, muS)) {
+        return Color(0.0, 0.0, 0.0);
+    }
+    return transmittanceToTop(r, muS);
+}
+
+Color Atmosphere::multipleScattering(double r, double muS) const
+{
+    double g = m_parameters.groundRadius, top = m_parameters.topRadius;
+    return toColor(bilinear(m_multipleScattering,
+                            MULTIPLE_SCATTERING_SIZE,
+                            MULTIPLE_SCATTERING_SIZE,
+                            0.5 * (muS + 1.0),
+                            (r - g) / (top - g)));
+}
+
+void Atmosphere::scatteringNode(int ir,
+                                int imu,
+                                int imuS,
+                                int inu,
+                                double& r,
+                                double& mu,
+                                double& muS,
+                                double& nu,
+                                bool& ground) const
+{
+    double g = m_parameters.groundRadius, top = m_parameters.topRadius;
+    double H = sqrt(top * top - g * g);
+
+    double rho = H * ir / (SCATTERING_R - 1.0);
+    r = sqrt(rho * rho + g * g);
+
+    // the first half of the view angles are of rays that hit the ground,
+    // by their distance to it, and the second half of rays that do not, by
+    // their distance to the top
+    int half = SCATTERING_MU / 2;
+    ground = imu < half;
+    if (ground) {
+        double dMin = r - g, dMax = rho;
+        double d = dMin + (dMax - dMin) * imu / (half - 1.0);
+        mu = d == 0.0 ? -1.0 : clampCosine(-(rho * rho + d * d) / (2.0 * r * d));
+    } else {
+        double dMin = top - r, dMax = rho + H;
+        double d = dMin + (dMax - dMin) * (imu - half) / (half - 1.0);
+        mu = d == 0.0 ? 1.0 : clampCosine((H * H - rho * rho - d * d) / (2.0 * r * d));
+    }
+
+    // the sun angle by the distance to the top from the ground, which puts
+    // more nodes near the horizon
+    double dMin = top - g, dMax = H;
+    double A = (distanceToTop(g, MIN_MU_S) - dMin) / (dMax - dMin);
+    double u = imuS / (SCATTERING_MU_S - 1.0);
+    double a = (A - u * A) / (1.0 + u * A);
+    double d = dMin + min(a, A) * (dMax - dMin);
+    muS = d == 0.0 ? 1.0 : clampCosine((H * H - d * d) / (2.0 * g * d));
+
+    // nu is limited by the other two angles
+    double spread = sqrt(max(0.0, (1.0 - mu * mu) * (1.0 - muS * muS)));
+    nu = max(mu * muS - spread, min(mu * muS + spread, -1.0 + 2.0 * inu / (SCATTERING_NU - 1.0)));
+}
+
+void Atmosphere::scattering(double r,
+                            double mu,
+                            double muS,
+                            double nu,
+                            bool ground,
+                            Color& rayleigh,
+                            Color& mie,
+                            Color& multiple) const
+{
+    double g = m_parameters.groundRadius, top = m_parameters.topRadius;
+    double H = sqrt(top * top - g * g);
+    r = max(g, min(top, r));
+    double rho = sqrt(max(0.0, r * r - g * g));
+
+    // the inverse of the mapping of scatteringNode(), in nodes
+    int half = SCATTERING_MU / 2;
+    double x;
+    if (ground) {
+        double dMin = r - g, dMax = rho;
+        x = dMax > dMin ? (distanceToGround(r, mu) - dMin) / (dMax - dMin) : 0.0;
+    } else {
+        double dMin = top - r, dMax = rho + H;
+        x = dMax > dMin ? (distanceToTop(r, mu) - dMin) / (dMax - dMin) : 0.0;
+    }
+
+    double dMin = top - g, dMax = H;
+    double A = (distanceToTop(g, MIN_MU_S) - dMin) / (dMax - dMin);
+    double a = (distanceToTop(g, muS) - dMin) / (dMax - dMin);
+    double u = max(1.0 - a / A, 0.0) / (1.0 + a);
+
+    double coordinates[4] = {
+        rho / H * (SCATTERING_R - 1),
+        max(0.0, min(1.0, x)) * (half - 1),
+        max(0.0, min(1.0, u)) * (SCATTERING_MU_S - 1),
+        0.5 * (nu + 1.0) * (SCATTERING_NU - 1)
+    };
+    int sizes[4] = { SCATTERING_R, half, SCATTERING_MU_S, SCATTERING_NU };
+    int first[4];
+    double weights[4];
+    for (int i = 0; i < 4; i++) {
+        double c = max(0.0, min(sizes[i] - 1.0, coordinates[i]));
+        first[i] = min((int)c, sizes[i] - 2);
+        weights[i] = c - first[i];
+    }
+    if (!ground) {
+        first[1] += half;
+    }
+
+    // interpolate between the 16 nodes around the point
+    float values[SCATTERING_VALUES] = { 0 };
+    for (int corner = 0; corner < 16; corner++) {
+        double w = 1.0;
+        int index[4];
+        for (int i = 0; i < 4; i++) {
+            bool upper = corner & (1 << i);
+            index[i] = first[i] + (upper ? 1 : 0);
+            w *= upper ? weights[i] : 1.0 - weights[i];
+        }
+
+        size_t node = ((((size_t)index[0] * SCATTERING_MU + index[1]) * SCATTERING_MU_S
+                        + index[2]) * SCATTERING_NU + index[3]) * SCATTERING_VALUES;
+        for (int v = 0; v < SCATTERING_VALUES; v++) {
+            values[v] += w * m_scattering[node + v];
+        }
+    }
+
+    rayleigh = Color(values[RAYLEIGH], values[RAYLEIGH + 1], values[RAYLEIGH + 2]);
+    mie = Color(values[MIE], values[MIE + 1], values[MIE + 2]);
+    multiple = Color(values[MULTIPLE], values[MULTIPLE + 1], values[MULTIPLE + 2]);
+}
+
+bool Atmosphere::enter(const vec3& x, const vec3& ray, double& t0, double& t1) const
+{
+    double top = m_parameters.topRadius;
+    double b = x.dot(ray);
+    double discriminant = b * b - (x.dot(x) - top * top);
+    if (discriminant < 0.0) {
+        return false;
+    }
+
+    double root = sqrt(discriminant);
+    t0 = max(0.0, -b - root);
+    t1 = -b + root;
+    return t1 > t0;
+}
+
+Color Atmosphere::scattering(const vec3& x,
+                             const vec3& ray,
+                             const vec3& sun,
+                             double t0,
+                             double t1,
+                             Color& transmittance) const
+{
+    vec3 p = x + t0 * ray;
+    double r = p.abs();
+    double mu = clampCosine(p.dot(ray) / r),
+           muS = clampCosine(p.dot(sun) / r),
+           nu = clampCosine(ray.dot(sun));
+    bool ground = hitsGround(r, mu);
+
+    Color rayleigh, mie, multiple;
+    scattering(r, mu, muS, nu, ground, rayleigh, mie, multiple);
+
+    // the light scattered from beyond the end of the segment is taken off,
+    // as it is seen through the segment
+    double d = t1 - t0;
+    double end = ground ? distanceToGround(r, mu) : distanceToTop(r, mu);
+    if (d < end) {
+        double rd = sqrt(d * d + 2.0 * r * mu * d + r * r);
+        double muD = clampCosine((r * mu + d) / rd),
+               muSD = clampCosine((r * muS + d * nu) / rd);
+        transmittance = this->transmittance(r, mu, d, ground);
+
+        Color rayleighD, mieD, multipleD;
+        scattering(rd, muD, muSD, nu, ground, rayleighD, mieD, multipleD);
+        rayleigh = toColor(rayleigh - transmittance.mul(rayleighD));
+        mie = toColor(mie - transmittance.mul(mieD));
+        multiple = toColor(multiple - transmittance.mul(multipleD));
+    } else {
+        transmittance = this->transmittance(r, mu, end, ground);
+    }
+
+    vec3 result = rayleighPhase(nu) * rayleigh
+                + miePhase(nu, m_parameters.mieAnisotropy) * mie
+                + multiple;
+    return Color(max(0.0, result.x()), max(0.0, result.y()), max(0.0, result.z()));
+}
+
+Color Atmosphere::transmittance(const vec3& x, const vec3& ray, double t0, double t1) const
+{
+    vec3 p = x + t0 * ray;
+    double r = p.abs();
+    double mu = clampCosine(p.dot(ray) / r);
+    bool ground = hitsGround(r, mu);
+    double end = ground ? distanceToGround(r, mu) : distanceToTop(r, mu);
+    return transmittance(r, mu, min(t1 - t0, end), ground);
+}
+
+Color Atmosphere::sunTransmittance(const vec3& x, const vec3& sun) const
+{
+    double r = x.abs();
+    return sunTransmittance(r, clampCosine(x.dot(sun) / r));
+}
@@ -0,0 +1,149 @@
+#ifndef __ATMOSPHERE_H_
+#define __ATMOSPHERE_H_
+
+#include <vector>
+#include <string>
+
+#include "vec3.h"
+#include "color.h"
+#include "workerpool.h"
+
+// sizes of the lookup tables. the scattering table has two halves along
+// mu, for rays that hit the ground and rays that do not.
+#define TRANSMITTANCE_MU 256
+#define TRANSMITTANCE_R 64
+#define SCATTERING_R 32
+#define SCATTERING_MU 64
+#define SCATTERING_MU_S 32
+#define SCATTERING_NU 8
+#define MULTIPLE_SCATTERING_SIZE 32
+
+// The physical makeup of an atmosphere, by default the earth's. Lengths
+// are in km and scattering coefficients per km; the atmosphere is scaled
+// to the radius of the planet it is put around.
+struct AtmosphereParameters {
+    AtmosphereParameters();
+
+    double groundRadius;
+    double topRadius;
+    Color rayleighScattering;
+    double rayleighScaleHeight;
+    double mieScattering;
+    double mieExtinction;
+    double mieScaleHeight;
+    // asymmetry of the mie phase function
+    double mieAnisotropy;
+    // average albedo of the ground, which light scattered more than once
+    // bounces off
+    double groundAlbedo;
+};
+
+// A shell of air around a planet, which scatters sunlight into the rays
+// that pass through it and dims the light along them. Light is scattered
+// once or more by molecules (rayleigh, which makes the sky blue and the
+// sunset red) and by aerosols (mie, which makes the haze around the sun).
+//
+// Everything that needs an integral along a ray is precomputed into tables
+// following Bruneton and Neyret: the transmittance from a point to the top
+// of the atmosphere by its radius r and the cosine mu of the view angle,
+// and the light scattered towards a point from along the whole ray by r,
+// mu, the cosine mu_s of the sun angle and the cosine nu between the view
+// and the sun. Light scattered more than once is added to the second table
+// from a small table of its isotropic part by r and mu_s, after Hillaire.
+// Shading a ray segment then takes a few lookups rather than a march.
+//
+// The tables only depend on the parameters, so they are computed on the
+// threads of a pool once, and can be saved to a file named by a hash of the
+// parameters to be loaded by later runs.
+class Atmosphere {
+public:
+    Atmosphere(const AtmosphereParameters& parameters = AtmosphereParameters());
+
+    inline const AtmosphereParameters& parameters() const { return m_parameters; }
+
+    // fill the tables
+    void compute(WorkerPool& pool);
+
+    // the file in directory that the tables for the parameters are kept in
+    std::string cacheFile(const std::string& directory) const;
+
+    // read the tables from their file in directory, or save them there.
+    // false if there is no file for the parameters, or it can not be
+    // written.
+    bool load(const std::string& directory);
+    bool save(const std::string& directory) const;
+
+    // light scattered towards the start of the part [t0, t1) of a ray inside
+    // the atmosphere, for sunlight of unit irradiance from direction sun,
+    // and the transmittance along it. x is the origin of the ray, relative
+    // to the center of the planet, in km.
+    Color scattering(const vec3& x,
+                     const vec3& ray,
+                     const vec3& sun,
+                     double t0,
+                     double t1,
+                     Color& transmittance) const;
+
+    // the transmittance along the part [t0, t1) of a ray
+    Color transmittance(const vec3& x, const vec3& ray, double t0, double t1) const;
+
+    // the transmittance of sunlight to a point x in the atmosphere, which
+    // is 0 where the sun is below the horizon
+    Color sunTransmittance(const vec3& x, const vec3& sun) const;
+
+    // the part [t0, t1) of a ray that is inside the atmosphere, after its
+    // origin
+    bool enter(const vec3& x, const vec3& ray, double& t0, double& t1) const;
+
+private:
+    class TransmittanceTask;
+    class MultipleScatteringTask;
+    class ScatteringTask;
+
+    // the values stored for each node of the scattering table
+    enum { RAYLEIGH = 0, MIE = 3, MULTIPLE = 6, SCATTERING_VALUES = 9 };
+
+    double distanceToTop(double r, double mu) const;
+    double distanceToGround(double r, double mu) const;
+    bool hitsGround(double r, double mu) const;
+
+    // the density of molecules and aerosols at radius r, relative to the
+    // ground
+    double rayleighDensity(double r) const;
+    double mieDensity(double r) const;
+
+    Color transmittanceToTop(double r, double mu) const;
+    Color transmittance(double r, double mu, double d, bool ground) const;
+    Color sunTransmittance(double r, double muS) const;
+    Color multipleScattering(double r, double muS) const;
+
+    // the scattering at r, mu, mu_s, nu, without the phase functions
+    void scattering(double r,
+                    double mu,
+                    double muS,
+                    double nu,
+                    bool ground,
+                    Color& rayleigh,
+                    Color& mie,
+                    Color& multiple) const;
+
+    // the parameters of a node of the scattering table
+    void scatteringNode(int r,
+                        int mu,
+                        int muS,
+                        int nu,
+                        double& nodeR,
+                        double& nodeMu,
+                        double& nodeMuS,
+                        double& nodeNu,
+                        bool& ground) const;
+
+    unsigned long long key() const;
+
+    AtmosphereParameters m_parameters;
+    std::vector<float> m_transmittance;
+    std::vector<float> m_multipleScattering;
+    std::vector<float> m_scattering;
+};
+
+#endif // __ATMOSPHERE_H_
@@ -0,0 +1,57 @@
+#include "camera.h"
+
+Camera::Camera(const vec3& eye, const vec3& lookingAt, double distanceToScreen)
+    : m_eye(eye)
+{
+    // construct a basis at the screens center
+    vec3 w = (eye - lookingAt).normalize();
+    m_u = vec3(0.0, 1.0, 0.0).cross(w);
+    m_v = w.cross(m_u);
+
+    // center of screen
+    m_center = eye - distanceToScreen * w;
+}
+
+vec3 Camera::ray(double a, double b) const
+{
+    // point on the virtual screen
+    vec3 p = m_center + (a * m_u) + (b * m_v);
+
+    // pew, pew, pew
+    return (p - m_eye).normalize();
+}
+
+vec3 Camera::direction() const
+{
+    return (m_center - m_eye).normalize();
+}
+
+bool Camera::project(const vec3& point, double& a, double& b) const
+{
+    // the screen axes are not unit length, so the coordinates along them
+    // are scaled by their squared length
+    vec3 d = point - m_eye;
+    vec3 forward = m_center - m_eye;
+    double depth = d.dot(forward);
+    if (depth <= 0) {
+        return false;
+    }
+
+    double scale = forward.dot(forward) / depth;
+    a = scale * d.dot(m_u) / m_u.dot(m_u);
+    b = scale * d.dot(m_v) / m_v.dot(m_v);
+    return true;
+}
+
+static bool sameVector(const vec3& a, const vec3& b)
+{
+    return a.x() == b.x() && a.y() == b.y() && a.z() == b.z();
+}
+
+bool Camera::sameView(const Camera& other) const
+{
+    return sameVector(m_eye, other.m_eye)
+        && sameVector(m_u, other.m_u)
+        && sameVector(m_v, other.m_v)
+        && sameVector(m_center, other.m_center);
+}
@@ -0,0 +1,35 @@
+#ifndef __CAMERA_H_
+#define __CAMERA_H_
+
+#include "vec3.h"
+
+// A pinhole camera. Rays leave the eye through a virtual screen placed at a
+// fixed distance towards the point being looked at.
+class Camera {
+public:
+    Camera(const vec3& eye, const vec3& lookingAt, double distanceToScreen);
+
+    inline const vec3& eye() const { return m_eye; }
+
+    // unit direction the camera looks in
+    vec3 direction() const;
+
+    // direction of the ray through the point (a, b) on the virtual screen,
+    // relative to its center
+    vec3 ray(double a, double b) const;
+
+    // the point (a, b) on the virtual screen that a point in front of the
+    // eye is seen through. false for points level with or behind the eye.
+    bool project(const vec3& point, double& a, double& b) const;
+
+    // check if both cameras send the same rays through the same points
+    bool sameView(const Camera& other) const;
+
+private:
+    vec3 m_eye;
+    vec3 m_u;
+    vec3 m_v;
+    vec3 m_center;
+};
+
+#endif // __CAMERA_H_
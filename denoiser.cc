@@ -0,0 +1,306 @@
+#include <algorithm>
+
+#include "denoiser.h"
+
+using namespace std;
+
+// the planes of the image being filtered
+struct DenoisePlanes {
+    DenoisePlanes(int width, int height)
+        : width(width),
+          height(height),
+          size(width * height),
+          data(13 * width * height) {}
+
+    inline float* plane(int index) { return &data[index * size]; }
+
+    int width;
+    int height;
+    int size;
+    std::vector<float> data;
+};
+
+// planes 0-5 hold the colors being read and written by a pass, and the rest
+// the features, which stay the same for all passes
+enum {
+    PLANE_R0, PLANE_G0, PLANE_B0,
+    PLANE_R1, PLANE_G1, PLANE_B1,
+    PLANE_ALBEDO_R, PLANE_ALBEDO_G, PLANE_ALBEDO_B,
+    PLANE_NORMAL_X, PLANE_NORMAL_Y, PLANE_NORMAL_Z,
+    PLANE_DEPTH
+};
+
+// pointers to one row of every plane
+struct DenoiseRow {
+    const float* r;
+    const float* g;
+    const float* b;
+    const float* albedoR;
+    const float* albedoG;
+    const float* albedoB;
+    const float* normalX;
+    const float* normalY;
+    const float* normalZ;
+    const float* depth;
+};
+
+// one pass of the filter, one row per item
+class DenoisePass : public Task {
+public:
+    DenoisePass(DenoisePlanes& planes,
+                int source,
+                int target,
+                int step,
+                float colorScale,
+                float albedoScale,
+                float normalScale,
+                float depthScale)
+        : m_planes(planes),
+          m_source(source),
+          m_target(target),
+          m_step(step),
+          m_colorScale(colorScale),
+          m_albedoScale(albedoScale),
+          m_normalScale(normalScale),
+          m_depthScale(depthScale) {}
+
+    virtual void run(int y);
+
+private:
+    DenoiseRow row(int y);
+    void accumulate(const DenoiseRow& center,
+                    const DenoiseRow& tap,
+                    int offset,
+                    float h,
+                    float* sumR,
+                    float* sumG,
+                    float* sumB,
+                    float* sumW);
+
+    DenoisePlanes& m_planes;
+    int m_source;
+    int m_target;
+    int m_step;
+    float m_colorScale;
+    float m_albedoScale;
+    float m_normalScale;
+    float m_depthScale;
+};
+
+DenoiseRow DenoisePass::row(int y)
+{
+    int offset = y * m_planes.width;
+
+    DenoiseRow row;
+    row.r = m_planes.plane(m_source) + offset;
+    row.g = m_planes.plane(m_source + 1) + offset;
+    row.b = m_planes.plane(m_source + 2) + offset;
+    row.albedoR = m_planes.plane(PLANE_ALBEDO_R) + offset;
+    row.albedoG = m_planes.plane(PLANE_ALBEDO_G) + offset;
+    row.albedoB = m_planes.plane(PLANE_ALBEDO_B) + offset;
+    row.normalX = m_planes.plane(PLANE_NORMAL_X) + offset;
+    row.normalY = m_planes.plane(PLANE_NORMAL_Y) + offset;
+    row.normalZ = m_planes.plane(PLANE_NORMAL_Z) + offset;
+    row.depth = m_planes.plane(PLANE_DEPTH) + offset;
+    return row;
+}
+
+// the weight of the tap at t of the tap row for the pixel at x of the
+// center row
+static inline float tapWeight(const DenoiseRow& center,
+                              int x,
+                              const DenoiseRow& tap,
+                              int t,
+                              float h,
+                              float colorScale,
+                              float albedoScale,
+                              float normalScale,
+                              float depthScale)
+{
+    float dr = center.r[x] - tap.r[t],
+          dg = center.g[x] - tap.g[t],
+          db = center.b[x] - tap.b[t];
+    float ar = center.albedoR[x] - tap.albedoR[t],
+          ag = center.albedoG[x] - tap.albedoG[t],
+          ab = center.albedoB[x] - tap.albedoB[t];
+    float nDotn = center.normalX[x] * tap.normalX[t]
+                + center.normalY[x] * tap.normalY[t]
+                + center.normalZ[x] * tap.normalZ[t];
+    float dz = (center.depth[x] - tap.depth[t]) / (center.depth[x] + 1.0f);
+
+    float c = (dr*dr + dg*dg + db*db) * colorScale;
+    float a = (ar*ar + ag*ag + ab*ab) * albedoScale;
+    float n = (1.0f - nDotn) * normalScale;
+    float z = dz * dz * depthScale;
+
+    return h / ((1.0f + c) * (1.0f + a) * (1.0f + n*n) * (1.0f + z));
+}
+
+// add the tap at x + offset of the tap row to the sums of the pixels of
+// the center row. taps outside of the image are clamped to its edge. the
+// pixels whose taps are inside make up one contiguous run, which is looped
+// over without branches so that the compiler vectorizes it.
+void DenoisePass::accumulate(const DenoiseRow& center,
+                             const DenoiseRow& tap,
+                             int offset,
+                             float h,
+                             float* sumR,
+                             float* sumG,
+                             float* sumB,
+                             float* sumW)
+{
+    int width = m_planes.width;
+    int first = min(width, max(0, -offset)),
+        last = max(first, min(width, width - offset));
+
+    for (int x = 0; x < width; x++) {
+        if (x == first) {
+            x = last;
+            if (x >= width) {
+                break;
+            }
+        }
+
+        int t = min(width - 1, max(0, x + offset));
+        float w = tapWeight(center, x, tap, t, h,
+                            m_colorScale, m_albedoScale, m_normalScale, m_depthScale);
+
+        sumR[x] += w * tap.r[t];
+        sumG[x] += w * tap.g[t];
+        sumB[x] += w * tap.b[t];
+        sumW[x] += w;
+    }
+
+    DenoiseRow shifted = tap;
+    shifted.r += offset;
+    shifted.g += offset;
+    shifted.b += offset;
+    shifted.albedoR += offset;
+    shifted.albedoG += offset;
+    shifted.albedoB += offset;
+    shifted.normalX += offset;
+    shifted.normalY += offset;
+    shifted.normalZ += offset;
+    shifted.depth += offset;
+
+    float colorScale = m_colorScale, albedoScale = m_albedoScale,
+          normalScale = m_normalScale, depthScale = m_depthScale;
+
+    // the sums never overlap the planes, but there are too many pointers
+    // for the compiler to check that at run time
+    #pragma GCC ivdep
+    for (int x = first; x < last; x++) {
+        float w = tapWeight(center, x, shifted, x, h,
+                            colorScale, albedoScale, normalScale, depthScale);
+
+        sumR[x] += w * shifted.r[x];
+        sumG[x] += w * shifted.g[x];
+        sumB[x] += w * shifted.b[x];
+        sumW[x] += w;
+    }
+}
+
+void DenoisePass::run(int y)
+{
+    // the 5 tap B3-spline, the same along both axes
+    static const float kernel[5] = { 1.0f/16, 1.0f/4, 3.0f/8, 1.0f/4, 1.0f/16 };
+
+    int width = m_planes.width;
+    vector<float> sums(4 * width, 0.0f);
+    float* sumR = &sums[0];
+    float* sumG = &sums[width];
+    float* sumB = &sums[2 * width];
+    float* sumW = &sums[3 * width];
+
+    DenoiseRow center = row(y);
+    for (int i = 0; i < 5; i++) {
+        int tapY = min(m_planes.height - 1, max(0, y + (i - 2) * m_step));
+        DenoiseRow tap = row(tapY);
+
+        for (int j = 0; j < 5; j++) {
+            accumulate(center,
+                       tap,
+                       (j - 2) * m_step,
+                       kernel[i] * kernel[j],
+                       sumR,
+                       sumG,
+                       sumB,
+                       sumW);
+        }
+    }
+
+    // the center tap has a weight of at least kernel[2]^2, so sumW > 0
+    float* r = m_planes.plane(m_target) + y * width;
+    float* g = m_planes.plane(m_target + 1) + y * width;
+    float* b = m_planes.plane(m_target + 2) + y * width;
+    #pragma GCC ivdep
+    for (int x = 0; x < width; x++) {
+        r[x] = sumR[x] / sumW[x];
+        g[x] = sumG[x] / sumW[x];
+        b[x] = sumB[x] / sumW[x];
+    }
+}
+
+Denoiser::Denoiser()
+    : m_iterations(5),
+      m_sigmaColor(0.1),
+      m_sigmaAlbedo(0.1),
+      m_sigmaNormal(0.1),
+      m_sigmaDepth(0.05)
+{
+}
+
+void Denoiser::denoise(Framebuffer& framebuffer, WorkerPool& pool)
+{
+    int width = framebuffer.width(), height = framebuffer.height();
+    DenoisePlanes planes(width, height);
+
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            int i = y * width + x;
+            int imageX = framebuffer.x0() + x, imageY = framebuffer.y0() + y;
+            const Color& color = framebuffer.at(imageX, imageY);
+            const PixelFeatures& features = framebuffer.features(imageX, imageY);
+
+            planes.plane(PLANE_R0)[i] = color.x();
+            planes.plane(PLANE_G0)[i] = color.y();
+            planes.plane(PLANE_B0)[i] = color.z();
+            planes.plane(PLANE_ALBEDO_R)[i] = features.albedo.x();
+            planes.plane(PLANE_ALBEDO_G)[i] = features.albedo.y();
+            planes.plane(PLANE_ALBEDO_B)[i] = features.albedo.z();
+            planes.plane(PLANE_NORMAL_X)[i] = features.normal.x();
+            planes.plane(PLANE_NORMAL_Y)[i] = features.normal.y();
+            planes.plane(PLANE_NORMAL_Z)[i] = features.normal.z();
+            planes.plane(PLANE_DEPTH)[i] = features.depth;
+        }
+    }
+
+    int source = PLANE_R0, target = PLANE_R1;
+    double sigmaColor = m_sigmaColor;
+    for (int i = 0; i < m_iterations; i++) {
+        // the colors get smoother with every pass, so the color weight
+        // gets stricter to keep the edges that are left
+        DenoisePass pass(planes,
+                         source,
+                         target,
+                         1 << i,
+                         1.0 / (sigmaColor * sigmaColor),
+                         1.0 / (m_sigmaAlbedo * m_sigmaAlbedo),
+                         1.0 / m_sigmaNormal,
+                         1.0 / (m_sigmaDepth * m_sigmaDepth * (1 << i) * (1 << i)));
+        pool.run(pass, height);
+
+        swap(source, target);
+        sigmaColor *= 0.5;
+    }
+
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            int i = y * width + x;
+            framebuffer.at(framebuffer.x0() + x, framebuffer.y0() + y)
+                = Color(planes.plane(source)[i],
+                        planes.plane(source + 1)[i],
+                        planes.plane(source + 2)[i]);
+        }
+    }
+}
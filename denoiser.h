@@ -0,0 +1,51 @@
+#ifndef __DENOISER_H_
+#define __DENOISER_H_
+
+#include <vector>
+
+#include "framebuffer.h"
+#include "workerpool.h"
+
+// An edge-avoiding a-trous wavelet filter. Each pass blurs the image with a
+// 5x5 B-spline kernel whose taps are spread twice as far apart as in the
+// pass before, and every tap is weighted down by how much its color,
+// albedo, normal and depth differ from the center pixel. Noise is smoothed
+// out over flat regions while texture, silhouette and shading edges stay
+// sharp.
+//
+// The image is filtered as planes of floats, one row per task, with the
+// inner loops running over contiguous pixels of a row so that they are
+// vectorized.
+class Denoiser {
+public:
+    Denoiser();
+
+    // filter the colors of a framebuffer with features in place
+    void denoise(Framebuffer& framebuffer, WorkerPool& pool);
+
+    inline int iterations() const { return m_iterations; }
+    inline void iterations(int v) { m_iterations = v; }
+
+    // the scale of the differences at which taps lose half their weight
+    inline double sigmaColor() const { return m_sigmaColor; }
+    inline void sigmaColor(double v) { m_sigmaColor = v; }
+
+    inline double sigmaAlbedo() const { return m_sigmaAlbedo; }
+    inline void sigmaAlbedo(double v) { m_sigmaAlbedo = v; }
+
+    inline double sigmaNormal() const { return m_sigmaNormal; }
+    inline void sigmaNormal(double v) { m_sigmaNormal = v; }
+
+    // relative to the depth of the center pixel and the tap distance
+    inline double sigmaDepth() const { return m_sigmaDepth; }
+    inline void sigmaDepth(double v) { m_sigmaDepth = v; }
+
+private:
+    int m_iterations;
+    double m_sigmaColor;
+    double m_sigmaAlbedo;
+    double m_sigmaNormal;
+    double m_sigmaDepth;
+};
+
+#endif // __DENOISER_H_
@@ -0,0 +1,206 @@
+#include <algorithm>
+
+#include "raytracer.h"
+#include "hash.h"
+#include "renderer.h"
+#include "dependencymap.h"
+
+using namespace std;
+
+Dependencies::Dependencies(int surfaces, int lights)
+    : m_surfaces(surfaces),
+      m_bits((surfaces + lights + 63) / 64)
+{
+}
+
+void Dependencies::add(const Dependencies& other)
+{
+    for (size_t i = 0; i < m_bits.size(); i++) {
+        m_bits[i] |= other.m_bits[i];
+    }
+}
+
+bool Dependencies::intersects(const Dependencies& other) const
+{
+    for (size_t i = 0; i < m_bits.size(); i++) {
+        if (m_bits[i] & other.m_bits[i]) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void Dependencies::clear()
+{
+    fill(m_bits.begin(), m_bits.end(), 0ULL);
+}
+
+DependencyMap::DependencyMap()
+    : m_camera(NULL),
+      m_settings(0),
+      m_geometry(0),
+      m_atmospheres(0),
+      m_surfaces(0),
+      m_lights(0),
+      m_tilesX(0),
+      m_tracedTiles(0),
+      m_frame(NULL)
+{
+}
+
+DependencyMap::~DependencyMap()
+{
+    delete m_camera;
+    delete m_frame;
+}
+
+bool DependencyMap::begin(const Renderer& renderer, const Framebuffer& framebuffer)
+{
+    const RenderSettings& settings = renderer.settings();
+    const Scene& scene = renderer.scene();
+    const vector<LightSource>& lights = renderer.lights();
+
+    // everything that shapes the frame besides the materials and lights
+    unsigned long long key = HASH_SEED;
+    key = hashValue(key, (double)framebuffer.x0());
+    key = hashValue(key, (double)framebuffer.y0());
+    key = hashValue(key, (double)framebuffer.width());
+    key = hashValue(key, (double)framebuffer.height());
+    key = hashValue(key, (double)framebuffer.hasFeatures());
+    key = hashValue(key, (double)settings.imageWidth);
+    key = hashValue(key, (double)settings.imageHeight);
+    key = hashValue(key, settings.screenWidth);
+    key = hashValue(key, settings.screenHeight);
+    key = hashValue(key, (double)settings.samples);
+    key = hashValue(key, (double)settings.seed);
+    key = hashValue(key, (double)settings.lightSamples);
+    key = hashValue(key, (double)settings.maxReflectionSteps);
+    key = hashValue(key, settings.minColorIntensity);
+    key = hashValue(key, settings.ambientColor);
+    key = hashValue(key, settings.radianceScale);
+    key = hashValue(key, (double)scene.size());
+    key = hashValue(key, (double)lights.size());
+
+    unsigned long long geometry;
+    bool known = scene.geometryKey(geometry);
+
+    unsigned long long atmospheres = HASH_SEED;
+    for (vector<Scene::AtmosphereShell>::const_iterator shell = scene.atmospheres().begin();
+         shell != scene.atmospheres().end();
+         shell++) {
+
+        atmospheres = hashValue(atmospheres, (double)(size_t)shell->atmosphere);
+        atmospheres = hashValue(atmospheres, shell->center);
+        atmospheres = hashValue(atmospheres, shell->radius);
+    }
+
+    vector<unsigned long long> materials(scene.size());
+    for (int id = 0; id < scene.size() && known; id++) {
+        known = scene.materialKey(id, materials[id]);
+    }
+
+    vector<unsigned long long> lightKeys;
+    for (vector<LightSource>::const_iterator light = lights.begin();
+         light != lights.end();
+         light++) {
+
+        unsigned long long lightKey = hashValue(HASH_SEED, light->location());
+        lightKey = hashValue(lightKey, light->radius());
+        lightKey = hashValue(lightKey, light->color());
+        lightKeys.push_back(lightKey);
+    }
+
+    bool whole = !known
+              || renderer.lightingCache() != NULL
+              || m_frame == NULL
+              || m_camera == NULL
+              || !m_camera->sameView(renderer.camera())
+              || m_settings != key
+              || m_geometry != geometry
+              || m_atmospheres != atmospheres;
+
+    // trace the tiles that touched a surface or light that changed
+    if (!whole) {
+        Dependencies changed(m_surfaces, m_lights);
+        for (int id = 0; id < scene.size(); id++) {
+            if (materials[id] != m_materials[id]) {
+                changed.addSurface(id);
+            }
+        }
+
+        bool lightsChanged = false;
+        for (size_t i = 0; i < lights.size(); i++) {
+            if (lightKeys[i] != m_lightKeys[i]) {
+                changed.addLight(i);
+                lightsChanged = true;
+            }
+        }
+
+        if (lightsChanged &&
+            ((int)lights.size() > min(settings.lightSamples, MAX_LIGHT_SAMPLES) ||
+             !scene.atmospheres().empty())) {
+
+            whole = true;
+        } else {
+            for (size_t t = 0; t < m_traced.size(); t++) {
+                m_traced[t] = m_tileDependencies[t].intersects(changed);
+                if (m_traced[t]) {
+                    m_tileDependencies[t].clear();
+                }
+            }
+        }
+    }
+
+    delete m_camera;
+    m_camera = new Camera(renderer.camera());
+    m_settings = key;
+    m_geometry = geometry;
+    m_atmospheres = atmospheres;
+    m_materials.swap(materials);
+    m_lightKeys.swap(lightKeys);
+    m_surfaces = scene.size();
+    m_lights = lights.size();
+
+    if (whole) {
+        m_tilesX = (framebuffer.width() + FRAMEBUFFER_TILE_SIZE - 1) / FRAMEBUFFER_TILE_SIZE;
+        int tilesY = (framebuffer.height() + FRAMEBUFFER_TILE_SIZE - 1) / FRAMEBUFFER_TILE_SIZE;
+        m_tileDependencies.assign(m_tilesX * tilesY, Dependencies(m_surfaces, m_lights));
+        m_traced.assign(m_tilesX * tilesY, true);
+    }
+
+    m_tracedTiles = count(m_traced.begin(), m_traced.end(), true);
+    return !whole;
+}
+
+bool DependencyMap::traced(int x, int y) const
+{
+    return m_traced[tile(x, y)];
+}
+
+void DependencyMap::restore(int x, int y, Framebuffer& framebuffer) const
+{
+    int x0 = framebuffer.x0() + x,
+        y0 = framebuffer.y0() + y,
+        x1 = min(x0 + FRAMEBUFFER_TILE_SIZE, framebuffer.x0() + framebuffer.width()),
+        y1 = min(y0 + FRAMEBUFFER_TILE_SIZE, framebuffer.y0() + framebuffer.height());
+
+    for (int py = y0; py < y1; py++) {
+        for (int px = x0; px < x1; px++) {
+            framebuffer.at(px, py) = m_frame->at(px, py);
+            if (framebuffer.hasFeatures()) {
+                framebuffer.features(px, py) = m_frame->features(px, py);
+            }
+        }
+    }
+}
+
+void DependencyMap::record(int x, int y, const Dependencies& dependencies)
+{
+    m_tileDependencies[tile(x, y)].add(dependencies);
+}
+
+void DependencyMap::end(const Framebuffer& framebuffer)
+{
+    delete m_frame;
+    m_frame = new Framebuffer(framebuffer);
+}
@@ -0,0 +1,110 @@
+#ifndef __DEPENDENCYMAP_H_
+#define __DEPENDENCYMAP_H_
+
+#include <vector>
+
+#include "camera.h"
+#include "framebuffer.h"
+
+class Renderer;
+
+// The surfaces and lights that the paths of the pixels of a tile touched:
+// every surface a path hit, whose material it read, and every light it
+// looked at from a hit, whether or not the hit faced it. Kept as one bit
+// per surface id followed by one bit per light.
+class Dependencies {
+public:
+    Dependencies(int surfaces, int lights);
+
+    inline void addSurface(int surface) { set(surface); }
+    inline void addLight(int light) { set(m_surfaces + light); }
+
+    // add the bits of other, which has the same surfaces and lights
+    void add(const Dependencies& other);
+
+    // check if any bit is set in both
+    bool intersects(const Dependencies& other) const;
+
+    void clear();
+
+private:
+    inline void set(int bit) { m_bits[bit >> 6] |= 1ULL << (bit & 63); }
+
+    int m_surfaces;
+    std::vector<unsigned long long> m_bits;
+};
+
+// The traced frame of a view and the dependencies of each of its tiles,
+// kept from one frame to the next. When a material changes, or a planet
+// turns its maps under the camera, only the pixels whose paths hit that
+// surface look different, which in a frame of mostly empty space is a
+// small share of the tiles. The tiles that touched nothing that changed
+// are copied from the last frame, and only the others are traced again.
+//
+// A blocked shadow ray depends on the shape of its occluder but not on its
+// material, and a ray that missed a surface could hit it once it moves, so
+// any change to the shapes of the scene, the view or the settings traces
+// the whole frame again, as do scenes with surfaces that are not packed,
+// whose materials the scene cannot see. Lights are tracked one by one while
+// every light is sampled at every hit. When only some are picked, or an
+// atmosphere scatters the light of all of them into every ray, a change to
+// any light traces the whole frame. A lighting cache makes pixels depend
+// on the tile that first filled a cell, so with one every tile is traced.
+//
+// The tiles are those the framebuffer stores its pixels in, and the pixels
+// come out the same as when the whole frame is traced.
+class DependencyMap {
+public:
+    DependencyMap();
+    ~DependencyMap();
+
+    // prepare for a frame of the window of framebuffer traced by renderer,
+    // and find the tiles that have to be traced again. returns false if
+    // all of them do.
+    bool begin(const Renderer& renderer, const Framebuffer& framebuffer);
+
+    // check if the tile with the corner (x, y) in the window is traced
+    bool traced(int x, int y) const;
+
+    // copy the pixels of a tile that is not traced from the last frame
+    void restore(int x, int y, Framebuffer& framebuffer) const;
+
+    // add to the dependencies of a traced tile
+    void record(int x, int y, const Dependencies& dependencies);
+
+    // keep the traced frame for the next one
+    void end(const Framebuffer& framebuffer);
+
+    // a blank set of the surfaces and lights of the frame
+    inline Dependencies dependencies() const { return Dependencies(m_surfaces, m_lights); }
+
+    // tiles in the window, and of those the tiles traced in this frame
+    inline int tiles() const { return m_traced.size(); }
+    inline int tracedTiles() const { return m_tracedTiles; }
+
+private:
+    DependencyMap(const DependencyMap&);
+    DependencyMap& operator=(const DependencyMap&);
+
+    inline int tile(int x, int y) const {
+        return (y / FRAMEBUFFER_TILE_SIZE) * m_tilesX + x / FRAMEBUFFER_TILE_SIZE;
+    }
+
+    // what the last frame was traced for
+    Camera* m_camera;
+    unsigned long long m_settings;
+    unsigned long long m_geometry;
+    unsigned long long m_atmospheres;
+    std::vector<unsigned long long> m_materials;
+    std::vector<unsigned long long> m_lightKeys;
+    int m_surfaces;
+    int m_lights;
+
+    int m_tilesX;
+    std::vector<Dependencies> m_tileDependencies;
+    std::vector<bool> m_traced;
+    int m_tracedTiles;
+    Framebuffer* m_frame;
+};
+
+#endif // __DEPENDENCYMAP_H_
@@ -0,0 +1,68 @@
+#include "profiler.h"
+#include "framebuffer.h"
+
+PixelFeatures::PixelFeatures()
+    : albedo(Color()),
+      normal(vec3()),
+      depth(0.0),
+      coverage(0.0)
+{
+}
+
+void PixelFeatures::add(const PixelFeatures& sample)
+{
+    albedo += sample.albedo;
+    normal += sample.normal;
+    depth += sample.depth;
+    coverage += sample.coverage;
+}
+
+void PixelFeatures::average(int samples)
+{
+    albedo /= samples;
+    if (normal.abs2() > 0.0) {
+        normal = normal.normalize();
+    }
+    if (coverage > 0.0) {
+        depth /= coverage;
+    }
+    coverage /= samples;
+}
+
+Framebuffer::Framebuffer(int width, int height, bool features)
+    : m_x0(0),
+      m_y0(0),
+      m_width(width),
+      m_height(height),
+      m_tilesX((width + FRAMEBUFFER_TILE_SIZE - 1) >> FRAMEBUFFER_TILE_SHIFT),
+      m_pixels(storage()),
+      m_features(features ? storage() : 0)
+{
+}
+
+Framebuffer::Framebuffer(int x0, int y0, int width, int height, bool features)
+    : m_x0(x0),
+      m_y0(y0),
+      m_width(width),
+      m_height(height),
+      m_tilesX((width + FRAMEBUFFER_TILE_SIZE - 1) >> FRAMEBUFFER_TILE_SHIFT),
+      m_pixels(storage()),
+      m_features(features ? storage() : 0)
+{
+}
+
+int Framebuffer::storage() const
+{
+    int tilesY = (m_height + FRAMEBUFFER_TILE_SIZE - 1) >> FRAMEBUFFER_TILE_SHIFT;
+    return (m_tilesX * tilesY) << (2 * FRAMEBUFFER_TILE_SHIFT);
+}
+
+void Framebuffer::write(gdImage* img, int x, int y) const
+{
+    ProfileScope profile(PROFILE_OUTPUT, m_width * m_height);
+    for (int j = 0; j < m_height; j++) {
+        for (int i = 0; i < m_width; i++) {
+            gdImageSetPixel(img, x + i, y + j, at(m_x0 + i, m_y0 + j).rgb());
+        }
+    }
+}
@@ -0,0 +1,92 @@
+#ifndef __FRAMEBUFFER_H_
+#define __FRAMEBUFFER_H_
+
+#include <vector>
+#include <gd.h>
+
+#include "vec3.h"
+#include "color.h"
+
+// the pixels are stored in square tiles of 2^FRAMEBUFFER_TILE_SHIFT pixels
+// on a side
+#define FRAMEBUFFER_TILE_SHIFT 4
+#define FRAMEBUFFER_TILE_SIZE (1 << FRAMEBUFFER_TILE_SHIFT)
+
+// Properties of the first surface seen through a pixel, which guide the
+// denoiser. While a pixel is traced they hold sums over its samples, and
+// average() turns them into the mean over the samples.
+struct PixelFeatures {
+    PixelFeatures();
+
+    void add(const PixelFeatures& sample);
+    void average(int samples);
+
+    Color albedo;
+    vec3 normal;
+    // distance to the first hit, averaged over the samples that hit
+    double depth;
+    // fraction of samples that hit a surface
+    double coverage;
+};
+
+// The linear colors of a rendered image, before they are gamma corrected
+// and quantized into a gd image. A framebuffer may hold just a window of
+// the image, in which case its pixels are still addressed by their
+// coordinates in the whole image.
+//
+// The pixels are laid out tile by tile rather than row by row, with the
+// rows of a tile next to each other, so that the pixels a worker traces
+// for one tile of the window are contiguous in memory instead of strided
+// across the rows of the whole image. They are only put back into rows
+// when they are written into an image.
+class Framebuffer {
+public:
+    // features are only stored when asked for, since only the denoiser
+    // needs them
+    Framebuffer(int width, int height, bool features = false);
+
+    // the window of width x height pixels from (x0, y0) of an image
+    Framebuffer(int x0, int y0, int width, int height, bool features = false);
+
+    inline int x0() const { return m_x0; }
+    inline int y0() const { return m_y0; }
+    inline int width() const { return m_width; }
+    inline int height() const { return m_height; }
+
+    inline Color& at(int x, int y) { return m_pixels[index(x, y)]; }
+    inline const Color& at(int x, int y) const { return m_pixels[index(x, y)]; }
+
+    inline bool hasFeatures() const { return !m_features.empty(); }
+    inline PixelFeatures& features(int x, int y) { return m_features[index(x, y)]; }
+    inline const PixelFeatures& features(int x, int y) const {
+        return m_features[index(x, y)];
+    }
+
+    // write the pixels into a true color image, with the first pixel of
+    // the window at (x, y) of the image
+    void write(gdImage* img, int x = 0, int y = 0) const;
+
+private:
+    inline int index(int x, int y) const {
+        int i = x - m_x0, j = y - m_y0;
+        int mask = FRAMEBUFFER_TILE_SIZE - 1;
+        int tile = (j >> FRAMEBUFFER_TILE_SHIFT) * m_tilesX + (i >> FRAMEBUFFER_TILE_SHIFT);
+        return (tile << (2 * FRAMEBUFFER_TILE_SHIFT))
+             + ((j & mask) << FRAMEBUFFER_TILE_SHIFT)
+             + (i & mask);
+    }
+
+    // the number of pixels held, padded out to whole tiles
+    int storage() const;
+
+    int m_x0;
+    int m_y0;
+    int m_width;
+    int m_height;
+    // tiles across the window
+    int m_tilesX;
+    std::vector<Color> m_pixels;
+    std::vector<PixelFeatures> m_features;
+};
+
+#endif // __FRAMEBUFFER_H_
@@ -0,0 +1,73 @@
+#include <algorithm>
+
+#include "gbuffer.h"
+#include "renderer.h"
+
+using namespace std;
+
+GBuffer::GBuffer(size_t budget)
+    : m_budget(budget),
+      m_reusing(false),
+      m_layers(0),
+      m_camera(NULL),
+      m_width(0),
+      m_height(0),
+      m_screenWidth(0.0),
+      m_screenHeight(0.0),
+      m_samples(0),
+      m_seed(0),
+      m_geometry(0)
+{
+}
+
+GBuffer::~GBuffer()
+{
+    delete m_camera;
+}
+
+bool GBuffer::begin(const Renderer& renderer)
+{
+    const RenderSettings& settings = renderer.settings();
+
+    // the rays of the samples depend on the view and on the random
+    // numbers that jitter them, and what they hit on the shapes
+    unsigned long long geometry;
+    bool known = renderer.scene().geometryKey(geometry);
+
+    m_reusing = known
+             && m_camera != NULL
+             && m_camera->sameView(renderer.camera())
+             && m_width == settings.imageWidth
+             && m_height == settings.imageHeight
+             && m_screenWidth == settings.screenWidth
+             && m_screenHeight == settings.screenHeight
+             && m_samples == settings.samples
+             && m_seed == settings.seed
+             && m_geometry == geometry;
+
+    if (m_reusing) {
+        return true;
+    }
+
+    delete m_camera;
+    m_camera = new Camera(renderer.camera());
+    m_width = settings.imageWidth;
+    m_height = settings.imageHeight;
+    m_screenWidth = settings.screenWidth;
+    m_screenHeight = settings.screenHeight;
+    m_samples = settings.samples;
+    m_seed = settings.seed;
+    m_geometry = geometry;
+
+    // nothing is kept for scenes whose geometry cannot be compared
+    size_t pixels = (size_t)m_width * m_height;
+    size_t bytesPerLayer = pixels * (sizeof(int) + sizeof(double));
+    m_layers = 0;
+    if (known && bytesPerLayer > 0) {
+        m_layers = min((size_t)renderer.sampleCount(), m_budget / bytesPerLayer);
+    }
+
+    m_surfaces.assign(pixels * m_layers, GBUFFER_EMPTY);
+    m_times.assign(pixels * m_layers, 0.0);
+    return false;
+}
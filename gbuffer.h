@@ -0,0 +1,82 @@
+#ifndef __GBUFFER_H_
+#define __GBUFFER_H_
+
+#include <vector>
+#include <cstddef>
+
+#include "camera.h"
+
+class Renderer;
+
+// The closest hits of the camera rays, kept from one frame to the next.
+// While the camera and the shapes of the scene stay put, every camera ray
+// hits the same surface at the same time in every frame, and only the
+// materials, shading and shadows need to be recomputed; a spinning planet
+// only changes where its maps are read. Each hit is kept as its time and
+// surface id, from which the scene rebuilds the hit point and normal.
+//
+// Hits are kept for as many samples per pixel as fit in the budget, and
+// the remaining samples are traced every frame. When the view or the
+// geometry changes, the stored hits are dropped and recorded anew.
+class GBuffer {
+public:
+    // keep at most budget bytes of hits
+    GBuffer(size_t budget);
+    ~GBuffer();
+
+    // prepare for a frame traced by renderer. returns true if the hits of
+    // the last frame are reused.
+    bool begin(const Renderer& renderer);
+
+    inline bool reusing() const { return m_reusing; }
+
+    // number of samples per pixel whose hits are kept
+    inline int layers() const { return m_layers; }
+
+    // check if the hit of a sample is kept
+    inline bool holds(int sample) const { return sample < m_layers; }
+
+    // the stored hit of a sample: the surface id, or -1 for a miss, and the
+    // time of the hit. false if it has not been recorded yet.
+    inline bool lookup(int x, int y, int sample, int& surface, double& time) const {
+        size_t i = index(x, y, sample);
+        surface = m_surfaces[i];
+        time = m_times[i];
+        return surface != GBUFFER_EMPTY;
+    }
+
+    inline void store(int x, int y, int sample, int surface, double time) {
+        size_t i = index(x, y, sample);
+        m_surfaces[i] = surface;
+        m_times[i] = time;
+    }
+
+private:
+    enum { GBUFFER_EMPTY = -2 };
+
+    GBuffer(const GBuffer&);
+    GBuffer& operator=(const GBuffer&);
+
+    inline size_t index(int x, int y, int sample) const {
+        return ((size_t)y * m_width + x) * m_layers + sample;
+    }
+
+    size_t m_budget;
+    bool m_reusing;
+    int m_layers;
+
+    // what the hits were traced for
+    Camera* m_camera;
+    int m_width;
+    int m_height;
+    double m_screenWidth;
+    double m_screenHeight;
+    int m_samples;
+    int m_seed;
+    unsigned long long m_geometry;
+
+    std::vector<int> m_surfaces;
+    std::vector<double> m_times;
+};
+
+#endif // __GBUFFER_H_
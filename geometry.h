@@ -0,0 +1,130 @@
+#ifndef __GEOMETRY_H_
+#define __GEOMETRY_H_
+
+#include <cmath>
+#include <algorithm>
+
+#include "raytracer.h"
+#include "vec3.h"
+
+// Ray intersection tests for the primitive shapes, shared by the Surface
+// classes and the packed scene storage. Each returns the distance along
+// the ray to the nearest hit in time.
+
+inline bool intersectSphere(const vec3& center,
+                            double radius,
+                            const vec3& origin,
+                            const vec3& ray,
+                            double maxTime,
+                            double& time)
+{
+    vec3 l = origin - center;
+    double B = 2.0 * ray.dot(l);
+    double C = l.abs2() - radius * radius;
+    double square = B * B  - 4 * C;
+    if (square < 0) {
+        return false;
+    }
+
+    double root = sqrt(square);
+    double t1 = 0.5 * (-B - root);
+    double t2 = 0.5 * (-B + root);
+
+    if (t1 >= EPSILON && t1 <= maxTime) {
+        time = t1;
+        return true;
+    }
+    else if (t2 >= EPSILON && t2 < maxTime) {
+        time = t2;
+        return true;
+    }
+
+    return false;
+}
+
+inline bool intersectPlane(const vec3& normal,
+                           const vec3& point,
+                           const vec3& origin,
+                           const vec3& ray,
+                           double maxTime,
+                           double& time)
+{
+    if (ray.dot(normal) < EPSILON) {
+        return false;
+    }
+
+    double t = (point - origin).dot(normal) / ray.dot(normal);
+    if (t > maxTime) {
+        return false;
+    }
+
+    time = t;
+    return true;
+}
+
+// the triangle spans location + u*a + v*b, and the dot products of a and b
+// are precomputed since they only depend on the triangle
+inline bool intersectTriangle(const vec3& location,
+                              const vec3& a,
+                              const vec3& b,
+                              const vec3& normal,
+                              double dotaa,
+                              double dotab,
+                              double dotbb,
+                              double invDenom,
+                              const vec3& origin,
+                              const vec3& ray,
+                              double maxTime,
+                              double& time)
+{
+    if (ray.dot(normal) < EPSILON) {
+        return false;
+    }
+
+    double t = (location - origin).dot(normal) / ray.dot(normal);
+    if (t > maxTime) {
+        return false;
+    }
+
+    vec3 c = origin + t * ray - location;
+
+    // http://www.blackpawn.com/texts/pointinpoly/
+    double dotac = a.dot(c);
+    double dotbc = b.dot(c);
+
+    double u = (dotbb * dotac - dotab * dotbc) * invDenom;
+    double v = (dotaa * dotbc - dotab * dotac) * invDenom;
+
+    if (u >= 0.0 && v >= 0.0 && u + v < 1.0) {
+        time = t;
+        return true;
+    }
+
+    return false;
+}
+
+// the boxes around the bounded primitive shapes
+
+inline void sphereBounds(const vec3& center, double radius, vec3& lo, vec3& hi)
+{
+    vec3 r(radius, radius, radius);
+    lo = center - r;
+    hi = center + r;
+}
+
+inline void triangleBounds(const vec3& location,
+                           const vec3& a,
+                           const vec3& b,
+                           vec3& lo,
+                           vec3& hi)
+{
+    vec3 p = location + a, q = location + b;
+    lo = vec3(std::min(location.x(), std::min(p.x(), q.x())),
+              std::min(location.y(), std::min(p.y(), q.y())),
+              std::min(location.z(), std::min(p.z(), q.z())));
+    hi = vec3(std::max(location.x(), std::max(p.x(), q.x())),
+              std::max(location.y(), std::max(p.y(), q.y())),
+              std::max(location.z(), std::max(p.z(), q.z())));
+}
+
+#endif // __GEOMETRY_H_
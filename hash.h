@@ -0,0 +1,43 @@
+#ifndef __HASH_H_
+#define __HASH_H_
+
+#include <cstring>
+
+#include "vec3.h"
+#include "material.h"
+
+// start of a running FNV-1a hash
+#define HASH_SEED 0xCBF29CE484222325ULL
+
+// fold the bits of a value into a running hash
+inline unsigned long long hashValue(unsigned long long hash, double value)
+{
+    unsigned long long bits;
+    memcpy(&bits, &value, sizeof(bits));
+    for (int i = 0; i < 8; i++) {
+        hash = (hash ^ ((bits >> (8 * i)) & 0xFF)) * 0x100000001B3ULL;
+    }
+    return hash;
+}
+
+inline unsigned long long hashValue(unsigned long long hash, const vec3& v)
+{
+    return hashValue(hashValue(hashValue(hash, v.x()), v.y()), v.z());
+}
+
+// fold the terms of a material into a running hash
+inline unsigned long long hashMaterial(unsigned long long hash, const Material& material)
+{
+    hash = hashValue(hash, material.ambientWeight());
+    hash = hashValue(hash, material.diffuseWeight());
+    hash = hashValue(hash, material.specularWeight());
+    hash = hashValue(hash, material.reflectionWeight());
+    hash = hashValue(hash, material.shininess());
+    hash = hashValue(hash, material.ambientColor());
+    hash = hashValue(hash, material.diffuseColor());
+    hash = hashValue(hash, material.highlightColor());
+    hash = hashValue(hash, material.reflectionColor());
+    return hash;
+}
+
+#endif // __HASH_H_
@@ -0,0 +1,323 @@
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#include "raytracer.h"
+#include "heightfield.h"
+
+using namespace std;
+
+// halvings of the interval in which a ray crossed the surface
+#define HEIGHTFIELD_BISECTIONS 32
+
+Heightfield::Heightfield(gdImage* elevation)
+    : m_width(gdImageSX(elevation)),
+      m_height(gdImageSY(elevation)),
+      m_heights(m_width * m_height)
+{
+    for (int y = 0; y < m_height; y++) {
+        for (int x = 0; x < m_width; x++) {
+            int color = gdImageGetPixel(elevation, x, y);
+            int gray = ((color >> 16) & 0xFF) + ((color >> 8) & 0xFF) + (color & 0xFF);
+            m_heights[y * m_width + x] = gray / (3.0 * 0xFF);
+        }
+    }
+
+    // the base level, of the squares between the pixel centers. the map
+    // wraps around in x, and a map of one row is its own next row.
+    int width = m_width, height = max(m_height - 1, 1);
+    vector<Range> nodes(width * height);
+    for (int j = 0; j < height; j++) {
+        int j1 = min(j + 1, m_height - 1);
+        for (int i = 0; i < width; i++) {
+            int i1 = (i + 1) % m_width;
+            float h00 = m_heights[j * m_width + i], h10 = m_heights[j * m_width + i1],
+                  h01 = m_heights[j1 * m_width + i], h11 = m_heights[j1 * m_width + i1];
+            Range& node = nodes[j * width + i];
+            node.lo = min(min(h00, h10), min(h01, h11));
+            node.hi = max(max(h00, h10), max(h01, h11));
+        }
+    }
+
+    while (true) {
+        // the blocks of 3x3 nodes around each node
+        Level level;
+        level.width = width;
+        level.height = height;
+        level.blocks.resize(width * height);
+        for (int j = 0; j < height; j++) {
+            for (int i = 0; i < width; i++) {
+                Range block = nodes[j * width + i];
+                for (int dj = -1; dj <= 1; dj++) {
+                    if (j + dj < 0 || j + dj >= height) {
+                        continue;
+                    }
+                    for (int di = -1; di <= 1; di++) {
+                        const Range& node = nodes[(j + dj) * width + (i + di + width) % width];
+                        block.lo = min(block.lo, node.lo);
+                        block.hi = max(block.hi, node.hi);
+                    }
+                }
+                level.blocks[j * width + i] = block;
+            }
+        }
+        m_levels.push_back(level);
+
+        if (width == 1 && height == 1) {
+            break;
+        }
+
+        // merge 2x2 nodes into the next level
+        int coarseWidth = (width + 1) / 2, coarseHeight = (height + 1) / 2;
+        vector<Range> coarse(coarseWidth * coarseHeight);
+        for (int j = 0; j < coarseHeight; j++) {
+            for (int i = 0; i < coarseWidth; i++) {
+                Range merged = nodes[2 * j * width + 2 * i];
+                for (int dj = 0; dj < 2 && 2 * j + dj < height; dj++) {
+                    for (int di = 0; di < 2 && 2 * i + di < width; di++) {
+                        const Range& node = nodes[(2 * j + dj) * width + 2 * i + di];
+                        merged.lo = min(merged.lo, node.lo);
+                        merged.hi = max(merged.hi, node.hi);
+                    }
+                }
+                coarse[j * coarseWidth + i] = merged;
+            }
+        }
+
+        nodes.swap(coarse);
+        width = coarseWidth;
+        height = coarseHeight;
+    }
+}
+
+double Heightfield::lowest() const
+{
+    return m_levels.back().blocks[0].lo;
+}
+
+double Heightfield::highest() const
+{
+    return m_levels.back().blocks[0].hi;
+}
+
+Heightfield::MapPoint Heightfield::mapPoint(const vec3& p, double theta0) const
+{
+    // the angles of sphereMap(), with the map shifted by half a pixel so
+    // that the pixel centers fall on whole coordinates
+    MapPoint point;
+    double r = p.abs();
+    point.theta = acos(max(-1.0, min(1.0, p.y() / r)));
+
+    double phi = atan2(p.z(), p.x()) + theta0;
+    if (phi > M_PI) {
+        phi = phi - 2*M_PI;
+    }
+    else if (phi < -M_PI) {
+        phi = phi + 2*M_PI;
+    }
+
+    point.u = m_width * (0.5 - phi / (2.0 * M_PI)) - 0.5;
+    if (point.u < 0.0) {
+        point.u += m_width;
+    }
+    if (point.u >= m_width) {
+        point.u -= m_width;
+    }
+
+    // the half pixels around the poles take the height of the first and
+    // last rows
+    const Level& base = m_levels.front();
+    point.v = max(0.0, min((double)(m_height - 1), point.theta * m_height / M_PI - 0.5));
+    point.i = min((int)point.u, base.width - 1);
+    point.j = min((int)point.v, base.height - 1);
+    return point;
+}
+
+double Heightfield::heightAt(const MapPoint& point) const
+{
+    int i1 = (point.i + 1) % m_width, j1 = min(point.j + 1, m_height - 1);
+    double fu = point.u - point.i, fv = point.v - point.j;
+    double h00 = m_heights[point.j * m_width + point.i], h10 = m_heights[point.j * m_width + i1],
+           h01 = m_heights[j1 * m_width + point.i], h11 = m_heights[j1 * m_width + i1];
+    return (1.0 - fv) * ((1.0 - fu) * h00 + fu * h10) + fv * ((1.0 - fu) * h01 + fu * h11);
+}
+
+double Heightfield::clearance(const vec3& p,
+                              const vec3& ray,
+                              const MapPoint& point,
+                              double radius,
+                              double scale) const
+{
+    double r = p.abs();
+    double axis = sqrt(p.x() * p.x() + p.z() * p.z());
+    double b = p.dot(ray);
+
+    double best = 0.0;
+    for (size_t l = 0; l < m_levels.size(); l++) {
+        const Level& level = m_levels[l];
+        int size = 1 << l;
+        int i = point.i >> l, j = point.j >> l;
+
+        double top = radius + scale * level.blocks[j * level.width + i].hi;
+        if (r <= top) {
+            break;
+        }
+
+        // until the ray drops below the highest ground of the block
+        double reach = numeric_limits<double>::infinity();
+        double discriminant = b * b - (r * r - top * top);
+        if (b < 0.0 && discriminant > 0.0) {
+            reach = -b - sqrt(discriminant);
+        }
+
+        // or leaves it through one of the meridians on its sides, unless it
+        // goes all the way around. any point past a meridian is at least
+        // the distance to its plane away.
+        if (level.width > 3) {
+            int left = (i + level.width - 1) % level.width,
+                right = (i + 1) % level.width;
+            double du = min(point.u - i * size + (min((left + 1) * size, m_width) - left * size),
+                            min((i + 1) * size, m_width) - point.u
+                            + (min((right + 1) * size, m_width) - right * size));
+            double dphi = du * 2.0 * M_PI / m_width;
+            reach = min(reach, axis * (dphi < M_PI / 2.0 ? sin(dphi) : 1.0));
+        }
+
+        // or through one of the circles of latitude above and below it,
+        // unless the block reaches the pole there
+        if (j >= 2) {
+            double dtheta = point.theta - ((j - 1) * size + 0.5) * M_PI / m_height;
+            reach = min(reach, r * (dtheta < M_PI / 2.0 ? sin(dtheta) : 1.0));
+        }
+        if (j + 2 < level.height) {
+            double dtheta = ((j + 2) * size + 0.5) * M_PI / m_height - point.theta;
+            reach = min(reach, r * (dtheta < M_PI / 2.0 ? sin(dtheta) : 1.0));
+        }
+
+        best = max(best, reach);
+    }
+
+    return best;
+}
+
+bool Heightfield::march(const vec3& origin,
+                        const vec3& ray,
+                        double radius,
+                        double scale,
+                        double theta0,
+                        double maxTime,
+                        bool any,
+                        double& time) const
+{
+    // the part of the ray inside the sphere around the highest ground
+    double outer = radius + scale * highest();
+    double b = origin.dot(ray);
+    double discriminant = b * b - (origin.abs2() - outer * outer);
+    if (discriminant < 0.0) {
+        return false;
+    }
+
+    double root = sqrt(discriminant);
+    double t0 = max(-b - root, EPSILON), t1 = min(-b + root, maxTime);
+    if (t1 < t0) {
+        return false;
+    }
+
+    // the steps close to the ground, of a quarter of a pixel of the map
+    double step = 0.25 * radius * min(M_PI / m_height, 2.0 * M_PI / m_width);
+
+    double t = t0;
+    vec3 p = origin + t * ray;
+    MapPoint point = mapPoint(p, theta0);
+    bool above = p.abs() > radius + scale * heightAt(point);
+    while (t < t1) {
+        double advance = above ? max(step, clearance(p, ray, point, radius, scale)) : step;
+        double next = min(t + advance, t1);
+
+        vec3 q = origin + next * ray;
+        MapPoint nextPoint = mapPoint(q, theta0);
+        bool nextAbove = q.abs() > radius + scale * heightAt(nextPoint);
+        if (above && !nextAbove) {
+            if (any) {
+                time = next;
+                return true;
+            }
+
+            // keep the end above the ground, so that rays leaving the hit
+            // start out above it
+            double lo = t, hi = next;
+            for (int k = 0; k < HEIGHTFIELD_BISECTIONS; k++) {
+                double mid = 0.5 * (lo + hi);
+                vec3 m = origin + mid * ray;
+                if (m.abs() > radius + scale * heightAt(mapPoint(m, theta0))) {
+                    lo = mid;
+                } else {
+                    hi = mid;
+                }
+            }
+
+            time = lo;
+            return true;
+        }
+
+        t = next;
+        p = q;
+        point = nextPoint;
+        above = nextAbove;
+    }
+
+    return false;
+}
+
+bool Heightfield::intersect(const vec3& origin,
+                            const vec3& ray,
+                            double radius,
+                            double scale,
+                            double theta0,
+                            double maxTime,
+                            double& time) const
+{
+    return march(origin, ray, radius, scale, theta0, maxTime, false, time);
+}
+
+bool Heightfield::occluded(const vec3& origin,
+                           const vec3& ray,
+                           double radius,
+                           double scale,
+                           double theta0,
+                           double maxTime) const
+{
+    double time;
+    return march(origin, ray, radius, scale, theta0, maxTime, true, time);
+}
+
+vec3 Heightfield::normal(const vec3& point, double scale, double theta0) const
+{
+    MapPoint m = mapPoint(point, theta0);
+    int i1 = (m.i + 1) % m_width, j1 = min(m.j + 1, m_height - 1);
+    double fu = m.u - m.i, fv = m.v - m.j;
+    double h00 = m_heights[m.j * m_width + m.i], h10 = m_heights[m.j * m_width + i1],
+           h01 = m_heights[j1 * m_width + m.i], h11 = m_heights[j1 * m_width + i1];
+
+    // the slopes of the radius along the angles. u runs against the
+    // azimuth, and v does not move in the bands around the poles.
+    double dhdu = (1.0 - fv) * (h10 - h00) + fv * (h11 - h01);
+    double dhdv = (1.0 - fu) * (h01 - h00) + fu * (h11 - h10);
+    double theta = m.theta * m_height / M_PI - 0.5;
+    if (theta < 0.0 || theta > m_height - 1) {
+        dhdv = 0.0;
+    }
+    double drdphi = -scale * dhdu * m_width / (2.0 * M_PI);
+    double drdtheta = scale * dhdv * m_height / M_PI;
+
+    // tilt the radial direction against the slopes
+    double r = point.abs();
+    double phi = atan2(point.z(), point.x());
+    double sinTheta = max(sin(m.theta), 1e-9), cosTheta = cos(m.theta);
+    vec3 radial = point / r;
+    vec3 alongTheta(cosTheta * cos(phi), -sinTheta, cosTheta * sin(phi));
+    vec3 alongPhi(-sin(phi), 0.0, cos(phi));
+
+    vec3 n = radial - (drdtheta / r) * alongTheta - (drdphi / (r * sinTheta)) * alongPhi;
+    return n.normalize();
+}
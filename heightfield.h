@@ -0,0 +1,125 @@
+#ifndef __HEIGHTFIELD_H_
+#define __HEIGHTFIELD_H_
+
+#include <vector>
+#include <gd.h>
+
+#include "vec3.h"
+
+// Terrain on a planet from an elevation map in the layout of its other
+// maps. The gray level of each pixel is the height of the ground there,
+// from black at the base radius of the planet to white at the full height
+// of the terrain, and heights are interpolated bilinearly between the
+// pixel centers.
+//
+// Rays are traced through the terrain over a min-max pyramid of the map.
+// Every node of the base level spans the square between four pixel centers,
+// so the lowest and highest ground under it are those of the four pixels;
+// every level above merges 2x2 nodes. Each node also stores the range of
+// its eight neighbors, which bounds the ground over a block of 3x3 nodes
+// around any point that falls in it. While a ray is above that bound, it
+// can skip ahead to where it either leaves the block or drops below the
+// bound, and it takes the coarsest level whose block it is above, so that
+// empty space far from the ground is crossed in a few steps. Only close to
+// the ground does it step at the resolution of the map, and a crossing of
+// the surface is then refined by bisection.
+//
+// A heightfield does not know the planet it is on. The base radius, the
+// full height of the terrain and the rotation of the maps are given with
+// every query, and points are relative to the center of the planet, so
+// that a map can be shared by several planets.
+class Heightfield {
+public:
+    Heightfield(gdImage* elevation);
+
+    inline int width() const { return m_width; }
+    inline int height() const { return m_height; }
+    inline int levels() const { return m_levels.size(); }
+
+    // the lowest and highest ground of the whole map, in [0, 1]
+    double lowest() const;
+    double highest() const;
+
+    // the first time in [EPSILON, maxTime] at which a ray comes down onto
+    // the terrain of a planet of the given base radius, whose white ground
+    // is scale above it. rays that start under the ground go up
+    // through it unhindered.
+    bool intersect(const vec3& origin,
+                   const vec3& ray,
+                   double radius,
+                   double scale,
+                   double theta0,
+                   double maxTime,
+                   double& time) const;
+
+    // check if the terrain blocks a ray before maxTime, without finding
+    // where
+    bool occluded(const vec3& origin,
+                  const vec3& ray,
+                  double radius,
+                  double scale,
+                  double theta0,
+                  double maxTime) const;
+
+    // the normal of the terrain at a point on it, which is only shaped by
+    // the slopes of the map and not by the radius of the planet
+    vec3 normal(const vec3& point, double scale, double theta0) const;
+
+private:
+    // the range of heights under a node, or a block of nodes
+    struct Range {
+        float lo;
+        float hi;
+    };
+
+    // nodes across and down a level of the pyramid
+    struct Level {
+        int width;
+        int height;
+        // the range of each node and its eight neighbors
+        std::vector<Range> blocks;
+    };
+
+    // where a point falls on the map, in pixels from the pixel center of
+    // the first node, and its angles
+    struct MapPoint {
+        double u;
+        double v;
+        int i;
+        int j;
+        double theta;
+    };
+
+    Heightfield(const Heightfield&);
+    Heightfield& operator=(const Heightfield&);
+
+    MapPoint mapPoint(const vec3& p, double theta0) const;
+    double heightAt(const MapPoint& point) const;
+
+    // the distance a ray from p can go without reaching the terrain, from
+    // the coarsest block of nodes around p it is above. 0 if it is not
+    // above the block of the base level.
+    double clearance(const vec3& p,
+                     const vec3& ray,
+                     const MapPoint& point,
+                     double radius,
+                     double scale) const;
+
+    // march a ray over the terrain. with any, stop at the first point found
+    // under the ground, without refining where the ray crossed it.
+    bool march(const vec3& origin,
+               const vec3& ray,
+               double radius,
+               double scale,
+               double theta0,
+               double maxTime,
+               bool any,
+               double& time) const;
+
+    int m_width;
+    int m_height;
+    std::vector<float> m_heights;
+    std::vector<Level> m_levels;
+};
+
+#endif // __HEIGHTFIELD_H_
@@ -0,0 +1,73 @@
+#include "hash.h"
+#include "lightingcache.h"
+
+using namespace std;
+
+LightingCache::LightingCache(int resolution)
+    : m_width(resolution),
+      m_height((resolution + 1) / 2),
+      m_lights(0),
+      m_key(0)
+{
+}
+
+void LightingCache::begin(const Scene& scene, const vector<LightSource>& lights)
+{
+    unsigned long long key = hashValue(scene.planetKey(), (double)scene.planets());
+    for (vector<LightSource>::const_iterator light = lights.begin();
+         light != lights.end();
+         light++) {
+
+        key = hashValue(key, light->location());
+        key = hashValue(key, light->radius());
+    }
+
+    size_t size = (size_t)scene.planets() * m_width * m_height * lights.size();
+    if (key == m_key && size == m_cells.size()) {
+        return;
+    }
+
+    // a new vector, since atomics cannot be assigned in bulk
+    vector<atomic<unsigned char> >(size).swap(m_cells);
+    m_lights = lights.size();
+    m_key = key;
+}
+
+unsigned char LightingCache::probe(const Scene& scene, const LightSource& light, int cell) const
+{
+    vec3 point, up;
+    if (!scene.planetCellPoint(cell, m_width, m_height, point, up)) {
+        return PENUMBRA;
+    }
+
+    // the samples of a light are spread over a box of its radius around it
+    static const double offsets[LIGHTING_CACHE_PROBES][3] = {
+        { 0.0, 0.0, 0.0 },
+        { -0.5, -0.5, -0.5 }, { 0.5, -0.5, -0.5 }, { -0.5, 0.5, -0.5 }, { 0.5, 0.5, -0.5 },
+        { -0.5, -0.5, 0.5 }, { 0.5, -0.5, 0.5 }, { -0.5, 0.5, 0.5 }, { 0.5, 0.5, 0.5 }
+    };
+
+    int reached = 0;
+    for (int i = 0; i < LIGHTING_CACHE_PROBES; i++) {
+        vec3 target = light.location()
+                    + light.radius() * vec3(offsets[i][0], offsets[i][1], offsets[i][2]);
+        vec3 direction = (target - point).normalize();
+        double distance = (target - point).abs();
+
+        // near the horizon, some hits of the cell face the light and some
+        // do not, so the middle does not speak for them
+        if (direction.dot(up) <= 0) {
+            return PENUMBRA;
+        }
+
+        int occluder;
+        if (!scene.occluded(point, direction, distance, -1, occluder)) {
+            reached++;
+        }
+    }
+
+    if (reached == 0) {
+        return BLOCKED;
+    }
+    return reached == LIGHTING_CACHE_PROBES ? VISIBLE : PENUMBRA;
+}
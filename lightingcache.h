@@ -0,0 +1,80 @@
+#ifndef __LIGHTINGCACHE_H_
+#define __LIGHTINGCACHE_H_
+
+#include <vector>
+#include <atomic>
+
+#include "lightsource.h"
+#include "surface.h"
+#include "scene.h"
+
+// shadow rays that decide a cell for a light: to its middle and to the
+// corners of the box its samples are spread over
+#define LIGHTING_CACHE_PROBES 9
+
+// Remembers which lights reach the texels of the planets. Samples of
+// neighbouring pixels hit the same region of a planet's maps over and
+// over, and for a light as far away as the sun they all get the same
+// answer from their shadow rays. The maps are divided into cells of a grid
+// of at most resolution x resolution / 2 cells per planet.
+//
+// A cell is decided by LIGHTING_CACHE_PROBES shadow rays from the ground in
+// its middle to fixed points spread over the light. If all of them reach
+// the light, or none do, every hit in the cell takes that answer; cells in
+// a penumbra, where they disagree, and cells that see the light at the
+// horizon keep tracing the shadow rays of their hits. The answer of a cell does not depend on which hit asked first, so
+// images come out the same whatever the order the threads fill it in. It
+// is still an approximation, since a hit at the edge of a cell can see
+// more or less of a light than its middle, which is why the cache is off
+// unless asked for.
+//
+// Cells are filled lazily and may be filled from several threads at once;
+// a cell holds one byte per light that is written whole, so racing
+// threads at worst both trace the probes. The cache is dropped when the
+// planets move or turn, or the lights move, since the cells are fixed to
+// the maps and not to the lights.
+class LightingCache {
+public:
+    LightingCache(int resolution);
+
+    // prepare for a frame of the scene, dropping the cache if it does not
+    // hold for it
+    void begin(const Scene& scene, const std::vector<LightSource>& lights);
+
+    // the cell of a hit, or -1 if the hit is not cached
+    inline int cell(const Scene& scene, const Intersection& hit) const {
+        return scene.planetCell(hit.surface(), hit.hit(), m_width, m_height);
+    }
+
+    // whether the light with the given index reaches a cell: 1 if it does,
+    // 0 if it is blocked and -1 if the hit has to trace its own shadow ray.
+    // the cell is probed the first time it is asked for.
+    inline int visible(const Scene& scene, const LightSource& light, int cell, int index) {
+        std::atomic<unsigned char>& state = m_cells[(size_t)cell * m_lights + index];
+        unsigned char value = state.load(std::memory_order_relaxed);
+        if (value == UNKNOWN) {
+            value = probe(scene, light, cell);
+            state.store(value, std::memory_order_relaxed);
+        }
+        return value == PENUMBRA ? -1 : value == VISIBLE;
+    }
+
+    inline int resolution() const { return m_width; }
+
+private:
+    enum { UNKNOWN, VISIBLE, BLOCKED, PENUMBRA };
+
+    LightingCache(const LightingCache&);
+    LightingCache& operator=(const LightingCache&);
+
+    // trace the probes of a cell towards a light
+    unsigned char probe(const Scene& scene, const LightSource& light, int cell) const;
+
+    int m_width;
+    int m_height;
+    int m_lights;
+    unsigned long long m_key;
+    std::vector<std::atomic<unsigned char> > m_cells;
+};
+
+#endif // __LIGHTINGCACHE_H_
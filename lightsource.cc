@@ -13,3 +13,8 @@ LightSource::LightSource(const vec3& location, double radius, const Color& color
       m_color(color)
 {
 }
+
+double LightSource::power() const
+{
+    return m_color.x() + m_color.y() + m_color.z();
+}
@@ -13,6 +13,9 @@ public:
     inline double radius() const { return m_radius; }
     inline const Color& color() const { return m_color; }
 
+    // total emitted power, used to estimate the contribution of the light
+    double power() const;
+
 private:
     vec3 m_location;
     double m_radius;
@@ -0,0 +1,160 @@
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#include "raytracer.h"
+#include "lighttree.h"
+
+using namespace std;
+
+// orders light indices by the position of the light along one axis
+class LightAxisOrder {
+public:
+    LightAxisOrder(const vector<LightSource>& lights, int axis)
+        : m_lights(lights), m_axis(axis) {}
+
+    bool operator()(int a, int b) const {
+        return component(m_lights[a].location()) < component(m_lights[b].location());
+    }
+
+private:
+    double component(const vec3& v) const {
+        return m_axis == 0 ? v.x() : (m_axis == 1 ? v.y() : v.z());
+    }
+
+    const vector<LightSource>& m_lights;
+    int m_axis;
+};
+
+LightTree::LightTree(const vector<LightSource>& lights)
+    : m_lights(lights)
+{
+    if (lights.empty()) {
+        return;
+    }
+
+    vector<int> indices;
+    for (int i = 0; i < (int)lights.size(); i++) {
+        indices.push_back(i);
+    }
+
+    m_nodes.reserve(2 * lights.size());
+    build(indices, 0, indices.size());
+}
+
+int LightTree::build(vector<int>& indices, int begin, int end)
+{
+    int index = m_nodes.size();
+    m_nodes.push_back(Node());
+
+    // bounds of the lights, grown by the jitter applied to area lights
+    double inf = numeric_limits<double>::infinity();
+    double lo[3] = { inf, inf, inf }, hi[3] = { -inf, -inf, -inf };
+    double power = 0.0;
+    for (int i = begin; i < end; i++) {
+        const LightSource& light = m_lights[indices[i]];
+        double half = 0.5 * light.radius();
+        double p[3] = { light.location().x(),
+                        light.location().y(),
+                        light.location().z() };
+        for (int a = 0; a < 3; a++) {
+            lo[a] = min(lo[a], p[a] - half);
+            hi[a] = max(hi[a], p[a] + half);
+        }
+        power += light.power();
+    }
+
+    Node node;
+    node.lo = vec3(lo[0], lo[1], lo[2]);
+    node.hi = vec3(hi[0], hi[1], hi[2]);
+    node.power = power;
+
+    if (end - begin == 1) {
+        node.left = indices[begin];
+        node.right = -1;
+        m_nodes[index] = node;
+        return index;
+    }
+
+    // split at the median along the longest axis of the bounds
+    int axis = 0;
+    for (int a = 1; a < 3; a++) {
+        if (hi[a] - lo[a] > hi[axis] - lo[axis]) {
+            axis = a;
+        }
+    }
+
+    int middle = begin + (end - begin) / 2;
+    nth_element(indices.begin() + begin,
+                indices.begin() + middle,
+                indices.begin() + end,
+                LightAxisOrder(m_lights, axis));
+
+    node.left = build(indices, begin, middle);
+    node.right = build(indices, middle, end);
+    m_nodes[index] = node;
+
+    return index;
+}
+
+double LightTree::importance(const Node& node, const vec3& p, const vec3& n) const
+{
+    if (node.power <= 0.0) {
+        return 0.0;
+    }
+
+    vec3 center = 0.5 * (node.lo + node.hi);
+    double radius = 0.5 * (node.hi - node.lo).abs();
+    vec3 toCenter = center - p;
+    double distance = toCenter.abs();
+
+    // points inside the bounds can be lit from any direction
+    if (distance <= radius) {
+        return node.power / max(radius * radius, EPSILON);
+    }
+
+    // the cone from p enclosing the bounding sphere of the node. if it lies
+    // entirely below the tangent plane, no light in the node contributes.
+    double cosCenter = min(1.0, max(-1.0, n.dot(toCenter) / distance));
+    double angle = acos(cosCenter) - asin(radius / distance);
+    if (angle >= M_PI / 2.0) {
+        return 0.0;
+    }
+
+    double cosBound = angle <= 0.0 ? 1.0 : cos(angle);
+    return node.power * cosBound / (distance * distance);
+}
+
+int LightTree::sample(const vec3& p, const vec3& n, double u, double& pdf) const
+{
+    pdf = 1.0;
+    if (m_nodes.empty()) {
+        return -1;
+    }
+
+    u = min(u, 1.0 - EPSILON);
+
+    int index = 0;
+    while (m_nodes[index].right != -1) {
+        const Node& node = m_nodes[index];
+        double left = importance(m_nodes[node.left], p, n);
+        double right = importance(m_nodes[node.right], p, n);
+        if (left + right <= 0.0) {
+            return -1;
+        }
+
+        double pLeft = left / (left + right);
+        if (u < pLeft) {
+            u = u / pLeft;
+            pdf *= pLeft;
+            index = node.left;
+        } else {
+            u = (u - pLeft) / (1.0 - pLeft);
+            pdf *= 1.0 - pLeft;
+            index = node.right;
+        }
+        u = min(u, 1.0 - EPSILON);
+    }
+
+    return m_nodes[index].left;
+}
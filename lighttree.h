@@ -0,0 +1,40 @@
+#ifndef __LIGHTTREE_H_
+#define __LIGHTTREE_H_
+
+#include <vector>
+
+#include "vec3.h"
+#include "lightsource.h"
+
+// A bounding volume hierarchy over the light sources of a scene. Instead of
+// tracing a shadow ray towards every light, the shading code walks the tree
+// and picks a light with a probability proportional to an estimate of its
+// contribution to the shading point (power, distance and orientation).
+class LightTree {
+public:
+    LightTree(const std::vector<LightSource>& lights);
+
+    // pick a light for the shading point p with normal n using the uniform
+    // random number u. returns the index of the light in the light vector
+    // and stores the probability of that choice in pdf, or returns -1 if
+    // no light can illuminate the point.
+    int sample(const vec3& p, const vec3& n, double u, double& pdf) const;
+
+private:
+    struct Node {
+        vec3 lo;
+        vec3 hi;
+        double power;
+        // children for interior nodes, or the light index and -1 for leaves
+        int left;
+        int right;
+    };
+
+    int build(std::vector<int>& indices, int begin, int end);
+    double importance(const Node& node, const vec3& p, const vec3& n) const;
+
+    const std::vector<LightSource>& m_lights;
+    std::vector<Node> m_nodes;
+};
+
+#endif // __LIGHTTREE_H_
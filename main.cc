@@ -1,11 +1,13 @@
 #include <iostream>
 #include <vector>
+#include <algorithm>
 #include <cstdlib>
+#include <cstring>
 #include <ctime>
 #include <cmath>
-#include <limits>
 #include <gd.h>
 #include <cstdio>
+#include <chrono>
 
 #include "raytracer.h"
 #include "vec3.h"
@@ -14,31 +16,258 @@
 #include "material.h"
 #include "lightsource.h"
 #include "surface.h"
+#include "scene.h"
+#include "camera.h"
+#include "framebuffer.h"
+#include "renderer.h"
+#include "spheremap.h"
+#include "workerpool.h"
+#include "denoiser.h"
+#include "gbuffer.h"
+#include "lightingcache.h"
+#include "sphereset.h"
+#include "multiview.h"
+#include "screenbins.h"
+#include "atmosphere.h"
+#include "heightfield.h"
+#include "profiler.h"
 
 using namespace std;
 
+// what main does besides rendering with the settings
+struct Options {
+    Options()
+        : frames(1),
+          asteroids(0),
+          cropX(0),
+          cropY(0),
+          cropWidth(0),
+          cropHeight(0),
+          composite(NULL),
+          checkBins(false),
+          atmosphere(false),
+          atmosphereCache("."),
+          terrain(NULL),
+          terrainHeight(1.0),
+          incremental(false) {}
+
+    int frames;
+    int asteroids;
+    // the window of the image to trace, or the whole image if cropWidth is 0
+    int cropX;
+    int cropY;
+    int cropWidth;
+    int cropHeight;
+    // a rendered frame to paste the window into, or NULL to write the
+    // window alone
+    const char* composite;
+    // angles of the eye around the planet, one view per angle
+    vector<double> views;
+    // trace the camera rays the screen bins found hits for, and compare
+    bool checkBins;
+    // put an atmosphere around the earth, whose tables are kept in files
+    // in atmosphereCache
+    bool atmosphere;
+    const char* atmosphereCache;
+    // an elevation map of the ground of the earth, or NULL for a smooth
+    // sphere, and the height of its white ground
+    const char* terrain;
+    double terrainHeight;
+    // keep the tiles of the last frame that depend on nothing that changed
+    bool incremental;
+};
+
+static void usage(const char* name)
+{
+    cerr << "usage: " << name << " [options]" << endl
+         << "  --size WxH       output size (2560x1440)" << endl
+         << "  --samples N      samples per pixel (100)" << endl
+         << "  --seed N         seed of the random numbers (current time)" << endl
+         << "  --frames N       frames of the planet spinning (1)" << endl
+         << "  --gbuffer MB     memory for camera hits reused across frames (512)" << endl
+         << "  --lighting-cache N  share shadow rays within N cells across planet maps (off)" << endl
+         << "  --asteroids N    put a belt of N rocks around the earth (0)" << endl
+         << "  --atmosphere     put an atmosphere around the earth" << endl
+         << "  --atmosphere-cache DIR  keep the tables of the atmosphere in DIR (.)" << endl
+         << "  --terrain FILE   raise the ground of the earth by an elevation map" << endl
+         << "  --terrain-height H  height of white on the map (1)" << endl
+         << "  --crop WxH+X+Y   only trace the pixels of a window of the image" << endl
+         << "  --composite FILE paste the window into a rendered frame instead of" << endl
+         << "                   writing it alone" << endl
+         << "  --views A,B,...  render from an eye at each angle in degrees (117)" << endl
+         << "  --tile-order O   trace the tiles in rows, morton or hilbert order (rows)" << endl
+         << "  --incremental    only trace the tiles that touched what changed since the" << endl
+         << "                   last frame" << endl
+         << "  --cost-schedule  split and order the tiles by a pre-pass that predicts their cost" << endl
+         << "  --wavefront      trace rays in sorted batches, stage by stage" << endl
+         << "  --profile        count cycles, instructions and misses of every stage of" << endl
+         << "                   tracing per frame" << endl
+         << "  --denoise        filter the noise out of the image, guided by features" << endl
+         << "  --bin-camera-hits  find the camera hits through bins of the surfaces on the" << endl
+         << "                   screen, into the g-buffer" << endl
+         << "  --check-bins     compare the binned camera hits against traced rays" << endl
+         << "  --exact-spheremap  map planet textures with libm instead of polynomials" << endl
+         << "  --check-spheremap  compare the polynomial planet mapping against libm" << endl;
+}
+
+static bool parseArguments(int argc,
+                           const char* argv[],
+                           RenderSettings& settings,
+                           Options& options)
+{
+    for (int i = 1; i < argc; i++) {
+        const char* arg = argv[i];
+        const char* value = i + 1 < argc ? argv[i + 1] : NULL;
+
+        if (strcmp(arg, "--wavefront") == 0) {
+            settings.wavefront = true;
+        }
+        else if (strcmp(arg, "--denoise") == 0) {
+            settings.denoise = true;
+        }
+        else if (strcmp(arg, "--incremental") == 0) {
+            options.incremental = true;
+        }
+        else if (strcmp(arg, "--profile") == 0) {
+            enableProfiling(true);
+        }
+        else if (strcmp(arg, "--cost-schedule") == 0) {
+            settings.costSchedule = true;
+        }
+        else if (strcmp(arg, "--bin-camera-hits") == 0) {
+            settings.binCameraHits = true;
+        }
+        else if (strcmp(arg, "--check-bins") == 0) {
+            settings.binCameraHits = true;
+            options.checkBins = true;
+        }
+        else if (strcmp(arg, "--atmosphere") == 0) {
+            options.atmosphere = true;
+        }
+        else if (strcmp(arg, "--exact-spheremap") == 0) {
+            exactSphereMap(true);
+        }
+        else if (strcmp(arg, "--check-spheremap") == 0) {
+            exit(checkSphereMap(1000000) ? 0 : 1);
+        }
+        else if (strcmp(arg, "--size") == 0 && value != NULL) {
+            if (sscanf(value, "%dx%d", &settings.imageWidth, &settings.imageHeight) != 2) {
+                return false;
+            }
+            settings.screenHeight = (settings.imageHeight * settings.screenWidth)
+                                  / settings.imageWidth;
+            i++;
+        }
+        else if (strcmp(arg, "--samples") == 0 && value != NULL) {
+            settings.samples = atoi(value);
+            i++;
+        }
+        else if (strcmp(arg, "--seed") == 0 && value != NULL) {
+            settings.seed = atoi(value);
+            i++;
+        }
+        else if (strcmp(arg, "--frames") == 0 && value != NULL) {
+            options.frames = atoi(value);
+            i++;
+        }
+        else if (strcmp(arg, "--gbuffer") == 0 && value != NULL) {
+            settings.gbufferBudget = (size_t)atoi(value) << 20;
+            i++;
+        }
+        else if (strcmp(arg, "--asteroids") == 0 && value != NULL) {
+            options.asteroids = atoi(value);
+            i++;
+        }
+        else if (strcmp(arg, "--crop") == 0 && value != NULL) {
+            if (sscanf(value, "%dx%d+%d+%d",
+                       &options.cropWidth,
+                       &options.cropHeight,
+                       &options.cropX,
+                       &options.cropY) != 4) {
+                return false;
+            }
+            i++;
+        }
+        else if (strcmp(arg, "--atmosphere-cache") == 0 && value != NULL) {
+            options.atmosphereCache = value;
+            i++;
+        }
+        else if (strcmp(arg, "--terrain") == 0 && value != NULL) {
+            options.terrain = value;
+            i++;
+        }
+        else if (strcmp(arg, "--terrain-height") == 0 && value != NULL) {
+            options.terrainHeight = atof(value);
+            i++;
+        }
+        else if (strcmp(arg, "--composite") == 0 && value != NULL) {
+            options.composite = value;
+            i++;
+        }
+        else if (strcmp(arg, "--views") == 0 && value != NULL) {
+            const char* angle = value;
+            while (true) {
+                char* end;
+                double degrees = strtod(angle, &end);
+                if (end == angle) {
+                    return false;
+                }
+                options.views.push_back(degrees * M_PI / 180.0);
+                if (*end != ',') {
+                    break;
+                }
+                angle = end + 1;
+            }
+            i++;
+        }
+        else if (strcmp(arg, "--tile-order") == 0 && value != NULL) {
+            if (!parseTileOrder(value, settings.tileOrder)) {
+                return false;
+            }
+            i++;
+        }
+        else if (strcmp(arg, "--lighting-cache") == 0 && value != NULL) {
+            settings.lightingCacheResolution = atoi(value);
+            i++;
+        }
+        else {
+            return false;
+        }
+    }
+
+    if (options.views.empty()) {
+        options.views.push_back(13*M_PI/20.0);
+    }
+
+    if (options.cropWidth == 0) {
+        options.cropWidth = settings.imageWidth;
+        options.cropHeight = settings.imageHeight;
+    }
+
+    return settings.imageWidth > 0 && settings.imageHeight > 0 && settings.samples > 0
+        && options.frames > 0 && options.asteroids >= 0
+        && settings.lightingCacheResolution >= 0
+        && options.cropX >= 0 && options.cropY >= 0
+        && options.cropWidth > 0 && options.cropHeight > 0
+        && options.cropX + options.cropWidth <= settings.imageWidth
+        && options.cropY + options.cropHeight <= settings.imageHeight
+        && (options.composite == NULL || options.views.size() == 1);
+}
+
 int main(int argc, const char* argv[])
 {
+    RenderSettings settings;
+    Options options;
+    if (!parseArguments(argc, argv, settings, options)) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    int num_frames = options.frames;
+    int num_asteroids = options.asteroids;
+
     // source of randomness
-    RandomDoubles random(time(NULL), 70001);
-    // distance from eye to screen, in the direction towards looking_at
-    double DISTANCE_TO_SCREEN = 100.0;
-    // output size
-    int IMAGE_WIDTH = 2560, IMAGE_HEIGHT = 1440;
-    // virtual screen size
-    double SCREEN_WIDTH = 100.0,
-           SCREEN_HEIGHT = (IMAGE_HEIGHT * SCREEN_WIDTH) / IMAGE_WIDTH;
-    // number of samples per pixel
-    int SAMPLES = 100;
-    double INVERSE_SAMPLES = 1.0/SAMPLES,
-           SQRT_SAMPLES = sqrt(SAMPLES),
-           INVERSE_SQRT_SAMPLES = 1.0/SQRT_SAMPLES;
-    // max number of reflection steps
-    int MAX_REFLECTION_STEPS = 10;
-    double MIN_COLOR_INTENSITY = 1.0 / 256.0;
-    // color of ambient light
-    Color AMBIENT_COLOR(1.0, 1.0, 1.0);
-    double RADIANCE_SCALE = 1.0;
+    RandomDoubles random(settings.seed, 70001);
 
     FILE* fh = fopen("earth_10k.png", "r");
     gdImage* map = gdImageCreateFromPng(fh);
@@ -56,15 +285,84 @@ int main(int argc, const char* argv[])
     gdImage* earthSpec = gdImageCreateFromPng(fh4);
     fclose(fh4);
 
-    int num_frames = 1;
+    // the pyramid over the elevation map is built once for all frames
+    Heightfield* terrain = NULL;
+    if (options.terrain != NULL) {
+        FILE* fh5 = fopen(options.terrain, "r");
+        if (fh5 == NULL) {
+            cerr << "could not read " << options.terrain << endl;
+            return 1;
+        }
+        gdImage* elevation = gdImageCreateFromPng(fh5);
+        fclose(fh5);
+
+        terrain = new Heightfield(elevation);
+        gdImageDestroy(elevation);
+        cout << "terrain: " << terrain->width() << "x" << terrain->height()
+             << ", " << terrain->levels() << " levels" << endl;
+    }
+
+    // a flat ring of rocks around the earth, the same in every frame
+    SphereSet asteroids;
+    if (num_asteroids > 0) {
+        int rock = asteroids.addMaterial(createMatte(Color(0.5, 0.45, 0.4)));
+        int ice = asteroids.addMaterial(createPlastic(Color(0.8, 0.85, 0.9)));
+
+        srand(1);
+        for (int i = 0; i < num_asteroids; i++) {
+            double angle = 2.0 * M_PI * rand() / RAND_MAX;
+            double radius = 140.0 + 50.0 * rand() / RAND_MAX;
+            double height = 4.0 * rand() / RAND_MAX - 2.0;
+            double size = 0.2 + 0.8 * rand() / RAND_MAX;
+            asteroids.add(vec3(radius * cos(angle), height, radius * sin(angle)),
+                          size,
+                          i % 8 == 0 ? ice : rock);
+        }
+        asteroids.build();
+    }
+
+    // the camera hits of every view outlive the frames, to be reused while
+    // the view stays
+    int num_views = options.views.size();
+    vector<GBuffer*> gbuffers;
+    for (int v = 0; v < num_views; v++) {
+        gbuffers.push_back(new GBuffer(settings.gbufferBudget / num_views));
+    }
+    vector<DependencyMap*> dependencyMaps;
+    for (int v = 0; v < num_views && options.incremental; v++) {
+        dependencyMaps.push_back(new DependencyMap());
+    }
+    LightingCache lightingCache(settings.lightingCacheResolution);
+
+    // traces the tiles of every view, and runs the denoiser
+    WorkerPool pool;
+
+    // the tables of the atmosphere take seconds to compute, so they are
+    // kept in a file for the next run
+    Atmosphere atmosphere;
+    if (options.atmosphere) {
+        if (atmosphere.load(options.atmosphereCache)) {
+            cout << "atmosphere: loaded " << atmosphere.cacheFile(options.atmosphereCache) << endl;
+        } else {
+            chrono::steady_clock::time_point start = chrono::steady_clock::now();
+            atmosphere.compute(pool);
+            cout << "atmosphere: computed in "
+                 << chrono::duration<double>(chrono::steady_clock::now() - start).count()
+                 << " s" << endl;
+            if (!atmosphere.save(options.atmosphereCache)) {
+                cerr << "could not write " << atmosphere.cacheFile(options.atmosphereCache) << endl;
+            }
+        }
+    }
+
+    // filled again for every frame. with the same objects in every frame,
+    // its object tree is refit to where they moved rather than rebuilt.
+    Scene scene;
+
     for (int nr = 0; nr < num_frames; nr++) {
 
     cout << "rendering frame " << nr << endl;
 
-    // setup target image
-    gdImage* img = gdImageCreateTrueColor(IMAGE_WIDTH, IMAGE_HEIGHT);
-    gdImageFill(img, 0, 0, 0);
-
     // define scene
     Material MIRROR = createPolishedMetal(Color(0.90, 0.90, 0.90));
     Material RED_METAL = createMetal(Color(1.0, 0.0, 0.0));
@@ -78,233 +376,212 @@ int main(int argc, const char* argv[])
 
     vector<LightSource> lights;
 
-    //double rot_theta = (nr % 40)/40.0 * 2.0 * M_PI;
     double rot_theta = -15*M_PI/20.0;
+    if (num_frames > 1) {
+        rot_theta = (nr % 40)/40.0 * 2.0 * M_PI;
+    }
 
     double distance_to_earth = 1e10;
     double plane_diff = distance_to_earth*sin(23.439*M_PI/180.0);
     lights.push_back(LightSource(vec3(distance_to_earth, plane_diff, 0.0),
                                  10000.0,
                                  Color(1.0, 1.0, 0.5)));
-    vector<Surface*> surfaces;
-    surfaces.push_back(new Planet(vec3(0.0, 0.0, 0.0),
-                                  100.0,
-                                  BLUE_MATTE,
-                                  map,
-                                  earthLights,
-                                  earthSpec,
-                                  rot_theta));
-    //surfaces.push_back(new Planet(vec3(-200.0, 0.0, -200.0),
-    //                              25.0,
-    //                              WHITE_MATTE,
-    //                              moon,
-    //                              NULL,
-    //                              NULL,
-    //                              0.0));
-
-    // position of eye
-    //double eye_theta = (nr % 100)/100.0 * 2.0 * M_PI;
-    double eye_theta = 13*M_PI/20.0;
-    double distance = 300.0;
-    vec3 eye(distance*cos(eye_theta), 300.0, distance*sin(eye_theta));
-
-    // where the eye is looking
-    vec3 looking_at(0.0, 0.0, 0);
-
-    // construct a basis at the screens center
-    vec3 w = (eye - looking_at).normalize();
-    vec3 u = vec3(0.0, 1.0, 0.0).cross(w);
-    vec3 v = w.cross(u);
-
-    // center of screen
-    vec3 c = eye - DISTANCE_TO_SCREEN * w;
-
-    for (int x = 0; x < IMAGE_WIDTH; x++) {
-        if (num_frames == 1) {
-            cout << x << " out of " << IMAGE_WIDTH << " done." << endl;
-        }
-
-        for (int y = 0; y < IMAGE_HEIGHT; y++) {
-
-            Color pixel;
-
-            // introduce some randomness
-            for (int i = 0; i < SQRT_SAMPLES; i++) {
-                double b = y + INVERSE_SQRT_SAMPLES * i;
-                if (SAMPLES == 1) {
-                    b += 0.5;
-                } else {
-                    b += random.next();
-                }
 
-                b = SCREEN_WIDTH / IMAGE_WIDTH * (IMAGE_HEIGHT / 2.0 - b);
-
-                for (int j = 0; j < SQRT_SAMPLES; j++) {
-                    double a = x + INVERSE_SQRT_SAMPLES * j;
-                    if (SAMPLES == 1) {
-                        a += 0.5;
-                    } else {
-                        a += random.next();
-                    }
-
-                    a = SCREEN_WIDTH / IMAGE_WIDTH * (a - IMAGE_WIDTH / 2.0);
-
-                    // point on the virtual screen
-                    vec3 p = c + (a * u) + (b * v);
-
-                    // pew, pew, pew
-                    vec3 d = (p - eye).normalize();
-
-                    vec3 f(RADIANCE_SCALE, RADIANCE_SCALE, RADIANCE_SCALE);
-                    vec3 o = eye;
-                    for (int k = 0; k < MAX_REFLECTION_STEPS; k++) {
-
-                        // find the object closest to the eye
-                        Intersection intersection;
-                        Intersection bestIntersection;
-                        for (vector<Surface*>::iterator surface = surfaces.begin();
-                             surface != surfaces.end();
-                             surface++) {
-
-                            if (!(*surface)->intersect(o,
-                                                       d,
-                                                       numeric_limits<double>::infinity(),
-                                                       intersection)) {
-                                continue;
-                            }
-
-                            if (intersection.time() < bestIntersection.time()) {
-                                bestIntersection = intersection;
-                            }
-                        }
-
-                        // nothing more to do if we didn't get an intersection
-                        if (!bestIntersection.initialized()) {
-                            break;
-                        }
-
-                        //pixel += Color(1.0, 1.0, 1.0);
-
-                        const Material& material = bestIntersection.material();
-                        if (material.ambientWeight() > 0.0) {
-                            pixel += material.ambientWeight()
-                                   * f.mul(AMBIENT_COLOR.mul(material.ambientColor()));
-                        }
-
-                        for (vector<LightSource>::iterator light = lights.begin();
-                             light != lights.end();
-                             light++) {
-
-                            if (d.dot(bestIntersection.normal()) >= 0) {
-                                // negate the direction of the normal
-                                bestIntersection.normal(-bestIntersection.normal());
-                            }
-
-                            double r1 = (random.next() - 0.5) * light->radius(),
-                                   r2 = (random.next() - 0.5) * light->radius(),
-                                   r3 = (random.next() - 0.5) * light->radius();
-                            const vec3& lightLoc = light->location()
-                                                 + vec3(r1, r2, r3);
-
-                            const Color& lightColor = light->color();
-                            vec3 l = (lightLoc - bestIntersection.hit()).normalize();
-
-                            double nDotl = l.dot(bestIntersection.normal());
-                            if (nDotl <= 0) {
-                                continue;
-                            }
-
-                            double maxTime = (lightLoc - bestIntersection.hit()).abs();
-
-                            // do a second pass across all objects in the scene,
-                            // and check if they shadow the object
-                            bool illuminated = true;
-                            Intersection lightIntersection;
-                            for (vector<Surface*>::iterator surface = surfaces.begin();
-                                 surface != surfaces.end();
-                                 surface++) {
-
-                                // a single object inbetween the current object,
-                                // and the light source is enough to shadow it
-                                if ((*surface)->intersect(bestIntersection.hit(),
-                                                          l,
-                                                          maxTime,
-                                                          lightIntersection)) {
-
-                                    illuminated = false;
-                                    break;
-                                }
-                            }
-
-                            if (!illuminated) {
-                                continue;
-                            }
-
-                            // diffuse
-                            if (material.diffuseWeight() > 0) {
-                                pixel += material.diffuseWeight()
-                                       * nDotl
-                                       * f.mul(lightColor.mul(material.diffuseColor()));
-                            }
-
-                            // specular
-                            if (material.specularWeight() > 0) {
-                                vec3 r = 2.0 * nDotl * bestIntersection.normal() - l;
-                                double rDotMd = -r.dot(d);
-                                if (rDotMd > 0) {
-                                    pixel += pow(rDotMd, material.shininess())
-                                           * material.specularWeight()
-                                           * nDotl
-                                           * f.mul(lightColor.mul(material.highlightColor()));
-                                }
-                            }
-                        }
-
-                        // reflection
-                        if (material.reflectionWeight() > 0) {
-                            f = material.reflectionWeight()
-                              * f.mul(material.reflectionColor());
-                            if (f.x() < MIN_COLOR_INTENSITY &&
-                                f.y() < MIN_COLOR_INTENSITY &&
-                                f.z() < MIN_COLOR_INTENSITY) {
-
-                                break;
-                            }
-
-                            const vec3& n = bestIntersection.normal();
-                            d = d - (2.0*d.dot(n)) * n;
-                            o = bestIntersection.hit();
-                        } else {
-                            break;
-                        }
-                    }
-                }
-            }
+    Planet earth(vec3(0.0, 0.0, 0.0),
+                 100.0,
+                 BLUE_MATTE,
+                 map,
+                 earthLights,
+                 earthSpec,
+                 rot_theta);
+    if (options.atmosphere) {
+        earth.atmosphere(&atmosphere);
+    }
+    if (terrain != NULL) {
+        earth.terrain(terrain, options.terrainHeight);
+    }
+    scene.add(earth);
+    if (num_asteroids > 0) {
+        scene.add(asteroids);
+    }
+    //Planet moonPlanet(vec3(-200.0, 0.0, -200.0),
+    //                  25.0,
+    //                  WHITE_MATTE,
+    //                  moon,
+    //                  NULL,
+    //                  NULL,
+    //                  0.0);
+    //scene.add(moonPlanet);
+    scene.build();
+    if (scene.treeObjects() > 0) {
+        if (scene.refitTime() > 0.0) {
+            cout << "object tree: refit " << scene.treeObjects() << " objects in "
+                 << 1000.0 * scene.refitTime() << " ms" << endl;
+        } else {
+            cout << "object tree: built over " << scene.treeObjects() << " objects in "
+                 << 1000.0 * scene.buildTime() << " ms" << endl;
+        }
+    }
+
+    if (settings.lightingCacheResolution > 0) {
+        lightingCache.begin(scene, lights);
+    }
+
+    // a camera per view, at the same distance from the planet
+    vector<Camera> cameras;
+    for (int v = 0; v < num_views; v++) {
+        //double eye_theta = (nr % 100)/100.0 * 2.0 * M_PI;
+        double eye_theta = options.views[v];
+        double distance = 300.0;
+        vec3 eye(distance*cos(eye_theta), 300.0, distance*sin(eye_theta));
+
+        // where the eye is looking
+        vec3 looking_at(0.0, 0.0, 0);
+
+        cameras.push_back(Camera(eye, looking_at, settings.distanceToScreen));
+    }
+
+    // the renderers and framebuffers refer to the cameras and each other,
+    // so the vectors are filled before any of them is taken apart
+    vector<Renderer*> renderers;
+    vector<Framebuffer> framebuffers;
+    for (int v = 0; v < num_views; v++) {
+        Renderer* renderer = new Renderer(settings, scene, lights, cameras[v], random);
+        if (gbuffers[v]->begin(*renderer) && gbuffers[v]->layers() > 0) {
+            cout << "reusing the camera hits of " << gbuffers[v]->layers()
+                 << " samples per pixel" << endl;
+        }
+        renderer->gbuffer(gbuffers[v]);
+        if (settings.lightingCacheResolution > 0) {
+            renderer->lightingCache(&lightingCache);
+        }
+        if (options.incremental) {
+            renderer->dependencyMap(dependencyMaps[v]);
+        }
+        renderers.push_back(renderer);
 
-            // set pixel to color
-            pixel /= SAMPLES * lights.size();
-            gdImageSetPixel(img, x, y, pixel.rgb());
+        framebuffers.push_back(Framebuffer(options.cropX,
+                                           options.cropY,
+                                           options.cropWidth,
+                                           options.cropHeight,
+                                           settings.denoise));
+    }
+
+    int cropX1 = options.cropX + options.cropWidth,
+        cropY1 = options.cropY + options.cropHeight;
+    if (settings.binCameraHits) {
+        for (int v = 0; v < num_views; v++) {
+            ScreenBins bins(*renderers[v]);
+            if (!bins.render(options.cropX, options.cropY, cropX1, cropY1, pool)) {
+                cout << "can not bin a scene with surfaces of its own" << endl;
+                break;
+            }
+            if (bins.tests() > 0) {
+                cout << "binned the camera hits of " << gbuffers[v]->layers()
+                     << " samples per pixel in " << bins.tests() << " tests" << endl;
+            }
+            if (options.checkBins) {
+                cout << "binned camera hits that differ from traced ones: "
+                     << bins.check(options.cropX, options.cropY, cropX1, cropY1)
+                     << endl;
+            }
         }
     }
 
-    char out_name[256];
-    sprintf(out_name, "earth/earth%d.png", nr);
+    // the samples of a pixel only depend on its place in the whole image,
+    // so the pixels of a window come out the same as in a full render, and
+    // the tiles can be traced in any order
+    MultiViewRenderer multiview;
+    for (int v = 0; v < num_views; v++) {
+        multiview.add(*renderers[v], framebuffers[v]);
+    }
+    multiview.render(pool, num_frames == 1);
+    if (num_views > 1) {
+        cout << "rendered " << num_views << " views in " << multiview.groups()
+             << " groups of coherent views" << endl;
+    }
+    for (int v = 0; v < num_views && options.incremental; v++) {
+        cout << "traced " << dependencyMaps[v]->tracedTiles() << " of "
+             << dependencyMaps[v]->tiles() << " tiles, the others kept from the last frame"
+             << endl;
+    }
+    if (settings.costSchedule) {
+        cout << "tile costs: " << multiview.tiles() << " tiles predicted at "
+             << multiview.predictedCost() << " s from " << multiview.probeTime()
+             << " s of probes, took " << multiview.actualCost() << " s ("
+             << 100.0 * multiview.costError() << "% off per tile)" << endl;
+    }
+
+    for (int v = 0; v < num_views; v++) {
+        Framebuffer& framebuffer = framebuffers[v];
+        if (settings.denoise) {
+            cout << "denoising" << endl;
+            Denoiser().denoise(framebuffer, pool);
+        }
 
-    cout << "Saving " << out_name << endl;
+        // setup target image, which is either the window alone or the frame
+        // it is pasted into
+        gdImage* img = NULL;
+        if (options.composite != NULL) {
+            FILE* compositeFh = fopen(options.composite, "r");
+            if (compositeFh != NULL) {
+                img = gdImageCreateFromPng(compositeFh);
+                fclose(compositeFh);
+            }
+            if (img == NULL ||
+                gdImageSX(img) != settings.imageWidth ||
+                gdImageSY(img) != settings.imageHeight) {
+
+                cerr << "can not paste into " << options.composite
+                     << ", which is not a " << settings.imageWidth << "x"
+                     << settings.imageHeight << " png" << endl;
+                return 1;
+            }
+            framebuffer.write(img, options.cropX, options.cropY);
+        } else {
+            img = gdImageCreateTrueColor(options.cropWidth, options.cropHeight);
+            gdImageFill(img, 0, 0, 0);
+            framebuffer.write(img);
+        }
+
+        long long lookups = multiview.shadowLookups(v), hits = multiview.shadowHits(v);
+        cout << "shadow cache: " << hits << " hits in " << lookups << " lookups ("
+             << (lookups > 0 ? 100.0 * hits / lookups : 0.0) << "%)" << endl;
+
+        // with several views, every view of a frame gets a file of its own
+        char out_name[256];
+        if (num_views == 1) {
+            sprintf(out_name, "earth/earth%d.png", nr);
+        } else {
+            sprintf(out_name, "earth/earth%d_%d.png", nr, v);
+        }
 
-    FILE* outFh = fopen(out_name, "w");
-    gdImagePng(img, outFh);
-    gdImageDestroy(img);
-    fclose(outFh);
+        cout << "Saving " << out_name << endl;
 
-    for (vector<Surface*>::iterator surface = surfaces.begin();
-         surface != surfaces.end();
-         surface++) {
+        FILE* outFh = fopen(out_name, "w");
+        gdImagePng(img, outFh);
+        gdImageDestroy(img);
+        fclose(outFh);
 
-        delete *surface;
+        delete renderers[v];
     }
 
+    if (profilingEnabled()) {
+        reportProfile(cout);
+        resetProfile();
+    }
+
+    scene.release();
+
+    }
+
+    for (int v = 0; v < num_views; v++) {
+        delete gbuffers[v];
+    }
+    for (int v = 0; v < num_views && options.incremental; v++) {
+        delete dependencyMaps[v];
     }
+    delete terrain;
 
     return 0;
 }
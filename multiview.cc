@@ -0,0 +1,355 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <mutex>
+
+#include "multiview.h"
+#include "wavefront.h"
+#include "shadowcache.h"
+
+using namespace std;
+
+// a tile of a view, as the offset of its corner in the framebuffer and its
+// size, and the time it is predicted to take
+struct ViewTile {
+    int view;
+    int x;
+    int y;
+    int width;
+    int height;
+    double cost;
+};
+
+// orders tiles from the most to the least expensive
+class TileCostOrder {
+public:
+    bool operator()(const ViewTile& a, const ViewTile& b) const { return a.cost > b.cost; }
+};
+
+// the predicted cost of a tile, from the probes inside it
+static double tileCost(const vector<double>& probes, int probesX, const ViewTile& tile)
+{
+    double cost = 0.0;
+    for (int y = tile.y; y < tile.y + tile.height; y += COST_PROBE_SPACING) {
+        for (int x = tile.x; x < tile.x + tile.width; x += COST_PROBE_SPACING) {
+            cost += probes[(y / COST_PROBE_SPACING) * probesX + x / COST_PROBE_SPACING];
+        }
+    }
+    return cost;
+}
+
+// split a tile, which is size pixels on a side unless the framebuffer cuts
+// it off, into quarters until no piece is predicted to cost more than target
+static void splitTile(const ViewTile& tile,
+                      int size,
+                      const vector<double>& probes,
+                      int probesX,
+                      double target,
+                      vector<ViewTile>& tiles)
+{
+    if (tile.cost <= target || size <= COST_PROBE_SPACING) {
+        tiles.push_back(tile);
+        return;
+    }
+
+    int half = size / 2;
+    for (int dy = 0; dy < tile.height; dy += half) {
+        for (int dx = 0; dx < tile.width; dx += half) {
+            ViewTile piece = tile;
+            piece.x = tile.x + dx;
+            piece.y = tile.y + dy;
+            piece.width = min(half, tile.width - dx);
+            piece.height = min(half, tile.height - dy);
+            piece.cost = tileCost(probes, probesX, piece);
+            splitTile(piece, half, probes, probesX, target, tiles);
+        }
+    }
+}
+
+// traces the probes of one tile of a view per item
+class MultiViewRenderer::ProbeTask : public Task {
+public:
+    ProbeTask(vector<View>& views, const vector<ViewTile>& tiles, vector<ShadowCache>& shadowCaches)
+        : m_views(views),
+          m_tiles(tiles),
+          m_shadowCaches(shadowCaches) {}
+
+    virtual void run(int index);
+
+private:
+    vector<View>& m_views;
+    const vector<ViewTile>& m_tiles;
+    vector<ShadowCache>& m_shadowCaches;
+};
+
+void MultiViewRenderer::ProbeTask::run(int index)
+{
+    const ViewTile& tile = m_tiles[index];
+    View& view = m_views[tile.view];
+    const Renderer& renderer = *view.renderer;
+    const Framebuffer& framebuffer = *view.framebuffer;
+
+    // the first sample of the pixel in the middle of every square between
+    // the probes stands for all samples of the pixels of the square
+    ShadowCache& shadowCache = m_shadowCaches[WorkerPool::worker() * m_views.size() + tile.view];
+    for (int y = tile.y; y < tile.y + tile.height; y += COST_PROBE_SPACING) {
+        for (int x = tile.x; x < tile.x + tile.width; x += COST_PROBE_SPACING) {
+            int width = min(COST_PROBE_SPACING, tile.x + tile.width - x),
+                height = min(COST_PROBE_SPACING, tile.y + tile.height - y);
+
+            chrono::steady_clock::time_point start = chrono::steady_clock::now();
+            renderer.traceSample(framebuffer.x0() + x + width / 2,
+                                 framebuffer.y0() + y + height / 2,
+                                 0,
+                                 shadowCache);
+            double time = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+            view.probes[(y / COST_PROBE_SPACING) * view.probesX + x / COST_PROBE_SPACING]
+                = time * width * height * renderer.sampleCount();
+        }
+    }
+}
+
+// traces one tile of a view per item
+class MultiViewRenderer::TileTask : public Task {
+public:
+    TileTask(vector<View>& views,
+             const vector<ViewTile>& tiles,
+             vector<ShadowCache>& shadowCaches,
+             bool progress)
+        : m_views(views),
+          m_tiles(tiles),
+          m_shadowCaches(shadowCaches),
+          m_times(tiles.size()),
+          m_progress(progress),
+          m_done(0) {}
+
+    virtual void run(int index);
+
+    // the time it took to trace a tile, in seconds
+    inline double time(int index) const { return m_times[index]; }
+
+private:
+    vector<View>& m_views;
+    const vector<ViewTile>& m_tiles;
+    vector<ShadowCache>& m_shadowCaches;
+    vector<double> m_times;
+    bool m_progress;
+
+    // guards the dependency maps and the count of tiles done
+    mutex m_mutex;
+    int m_done;
+};
+
+void MultiViewRenderer::TileTask::run(int index)
+{
+    const ViewTile& tile = m_tiles[index];
+    View& view = m_views[tile.view];
+    const Renderer& renderer = *view.renderer;
+    Framebuffer& framebuffer = *view.framebuffer;
+
+    int x0 = framebuffer.x0() + tile.x,
+        y0 = framebuffer.y0() + tile.y,
+        x1 = x0 + tile.width,
+        y1 = y0 + tile.height;
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+
+    // every worker keeps the shadow cache of a view from tile to tile, so
+    // the occluders found at the edge of one tile are tried first in the next
+    ShadowCache& shadowCache = m_shadowCaches[WorkerPool::worker() * m_views.size() + tile.view];
+    DependencyMap* map = renderer.dependencyMap();
+    Dependencies dependencies = map != NULL ? map->dependencies() : Dependencies(0, 0);
+    Dependencies* recorded = map != NULL ? &dependencies : NULL;
+    if (renderer.settings().wavefront) {
+        WavefrontRenderer wavefront(renderer);
+        wavefront.render(framebuffer, x0, y0, x1, y1, shadowCache, recorded);
+    } else {
+        renderer.render(framebuffer, x0, y0, x1, y1, shadowCache, recorded);
+    }
+    m_times[index] = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    lock_guard<mutex> lock(m_mutex);
+    if (map != NULL) {
+        map->record(tile.x, tile.y, dependencies);
+    }
+
+    int total = m_tiles.size();
+    m_done++;
+    if (m_progress && m_done * 10 / total != (m_done - 1) * 10 / total) {
+        cout << 100 * m_done / total << "% of the tiles done." << endl;
+    }
+}
+
+MultiViewRenderer::MultiViewRenderer()
+    : m_groups(0),
+      m_tiles(0),
+      m_probeTime(0.0),
+      m_predictedCost(0.0),
+      m_actualCost(0.0),
+      m_costError(0.0)
+{
+}
+
+void MultiViewRenderer::add(const Renderer& renderer, Framebuffer& framebuffer)
+{
+    View view;
+    view.renderer = &renderer;
+    view.framebuffer = &framebuffer;
+    view.lookups = 0;
+    view.hits = 0;
+    view.probesX = 0;
+    m_views.push_back(view);
+}
+
+void MultiViewRenderer::render(WorkerPool& pool, bool progress)
+{
+    if (m_views.empty()) {
+        return;
+    }
+
+    // gather the views into groups that look in about the same direction as
+    // the first view of the group
+    vector<vector<int> > groups;
+    for (size_t i = 0; i < m_views.size(); i++) {
+        m_views[i].lookups = 0;
+        m_views[i].hits = 0;
+
+        DependencyMap* map = m_views[i].renderer->dependencyMap();
+        if (map != NULL) {
+            map->begin(*m_views[i].renderer, *m_views[i].framebuffer);
+        }
+
+        vec3 direction = m_views[i].renderer->camera().direction();
+        if (groups.empty() ||
+            direction.dot(m_views[groups.back().front()].renderer->camera().direction())
+                < COHERENT_VIEW_COSINE) {
+
+            groups.push_back(vector<int>());
+        }
+        groups.back().push_back(i);
+    }
+    m_groups = groups.size();
+
+    // the tiles of each group in turn, with the same tile of every view of
+    // the group next to each other
+    const Framebuffer& window = *m_views[0].framebuffer;
+    const RenderSettings& settings = m_views[0].renderer->settings();
+    int tilesX = (window.width() + RENDER_TILE_SIZE - 1) / RENDER_TILE_SIZE,
+        tilesY = (window.height() + RENDER_TILE_SIZE - 1) / RENDER_TILE_SIZE;
+    vector<int> order = orderTiles(tilesX, tilesY, settings.tileOrder);
+
+    vector<ViewTile> tiles;
+    vector<size_t> groupEnds;
+    for (vector<vector<int> >::iterator group = groups.begin();
+         group != groups.end();
+         group++) {
+
+        for (vector<int>::iterator t = order.begin(); t != order.end(); t++) {
+            for (vector<int>::iterator view = group->begin();
+                 view != group->end();
+                 view++) {
+
+                ViewTile tile;
+                tile.view = *view;
+                tile.x = (*t % tilesX) * RENDER_TILE_SIZE;
+                tile.y = (*t / tilesX) * RENDER_TILE_SIZE;
+                tile.width = min(RENDER_TILE_SIZE, window.width() - tile.x);
+                tile.height = min(RENDER_TILE_SIZE, window.height() - tile.y);
+                tile.cost = 0.0;
+
+                // tiles that depend on nothing that changed are kept
+                DependencyMap* map = m_views[*view].renderer->dependencyMap();
+                if (map != NULL && !map->traced(tile.x, tile.y)) {
+                    map->restore(tile.x, tile.y, *m_views[*view].framebuffer);
+                    continue;
+                }
+                tiles.push_back(tile);
+            }
+        }
+        groupEnds.push_back(tiles.size());
+    }
+
+    // a shadow cache for every view in every worker, kept over the probes and
+    // the tiles of the frame
+    vector<ShadowCache> shadowCaches;
+    for (int worker = 0; worker < pool.threads(); worker++) {
+        for (vector<View>::iterator view = m_views.begin(); view != m_views.end(); view++) {
+            shadowCaches.push_back(ShadowCache(view->renderer->lights().size()));
+        }
+    }
+
+    m_probeTime = 0.0;
+    if (settings.costSchedule) {
+        // predict the cost of every tile from the probes inside it
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        for (vector<View>::iterator view = m_views.begin(); view != m_views.end(); view++) {
+            view->probesX = (window.width() + COST_PROBE_SPACING - 1) / COST_PROBE_SPACING;
+            view->probes.assign(view->probesX
+                                * ((window.height() + COST_PROBE_SPACING - 1) / COST_PROBE_SPACING),
+                                0.0);
+        }
+        ProbeTask probes(m_views, tiles, shadowCaches);
+        pool.run(probes, tiles.size());
+        m_probeTime = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+        double total = 0.0;
+        for (vector<ViewTile>::iterator tile = tiles.begin(); tile != tiles.end(); tile++) {
+            const View& view = m_views[tile->view];
+            tile->cost = tileCost(view.probes, view.probesX, *tile);
+            total += tile->cost;
+        }
+
+        // split the expensive tiles, and hand out the tiles of every group
+        // from the most expensive down
+        double target = total / (pool.threads() * COST_TILES_PER_THREAD);
+        vector<ViewTile> scheduled;
+        size_t first = 0;
+        for (vector<size_t>::iterator end = groupEnds.begin(); end != groupEnds.end(); end++) {
+            size_t begin = scheduled.size();
+            for (size_t i = first; i < *end; i++) {
+                const View& view = m_views[tiles[i].view];
+                splitTile(tiles[i], RENDER_TILE_SIZE, view.probes, view.probesX, target, scheduled);
+            }
+            stable_sort(scheduled.begin() + begin, scheduled.end(), TileCostOrder());
+            first = *end;
+        }
+        tiles.swap(scheduled);
+    }
+    m_tiles = tiles.size();
+
+    TileTask task(m_views, tiles, shadowCaches, progress);
+    pool.run(task, tiles.size());
+
+    for (size_t i = 0; i < shadowCaches.size(); i++) {
+        View& view = m_views[i % m_views.size()];
+        view.lookups += shadowCaches[i].lookups();
+        view.hits += shadowCaches[i].hits();
+    }
+
+    for (vector<View>::iterator view = m_views.begin(); view != m_views.end(); view++) {
+        DependencyMap* map = view->renderer->dependencyMap();
+        if (map != NULL) {
+            map->end(*view->framebuffer);
+        }
+    }
+
+    // compare the predicted cost of the tiles with the time they took. the
+    // schedule only uses the cost of a tile relative to the others, so the
+    // error of every tile is taken after scaling the predictions to the
+    // time all tiles took.
+    m_predictedCost = 0.0;
+    m_actualCost = 0.0;
+    m_costError = 0.0;
+    for (size_t i = 0; i < tiles.size(); i++) {
+        m_predictedCost += tiles[i].cost;
+        m_actualCost += task.time(i);
+    }
+    if (m_predictedCost > 0.0 && m_actualCost > 0.0) {
+        double scale = m_actualCost / m_predictedCost;
+        for (size_t i = 0; i < tiles.size(); i++) {
+            m_costError += fabs(scale * tiles[i].cost - task.time(i));
+        }
+        m_costError /= m_actualCost;
+    }
+}
@@ -0,0 +1,116 @@
+#ifndef __MULTIVIEW_H_
+#define __MULTIVIEW_H_
+
+#include <vector>
+
+#include "renderer.h"
+#include "framebuffer.h"
+#include "workerpool.h"
+
+// side of the square tiles the views are traced in, which are the tiles
+// the framebuffers store their pixels in
+#define RENDER_TILE_SIZE FRAMEBUFFER_TILE_SIZE
+
+// views whose directions are closer than this cosine see mostly the same
+// objects, and have their tiles interleaved
+#define COHERENT_VIEW_COSINE 0.9
+
+// pixels between the probes of the cost pre-pass in both directions, which
+// is also the side of the smallest piece a tile is split into
+#define COST_PROBE_SPACING 4
+
+// tiles are split until none is predicted to cost more than the work of a
+// thread divided by this
+#define COST_TILES_PER_THREAD 8
+
+// Traces one frame of a scene from several cameras in one pass over a
+// shared worker pool, such as a stereo pair or a turntable of views. The
+// scene, its textures and the caches of the frame are set up once, and each
+// view only has its own renderer and framebuffer.
+//
+// The framebuffers are cut into tiles, which are handed out in the tile
+// order of the settings. Views that look in nearly the same
+// direction are gathered into a group, and the tiles of a group are handed
+// out interleaved: a tile of every view in turn before the next tile, so
+// that the rays of the views go through the same objects and textures while
+// they are still cached. Views that look elsewhere are rendered in groups
+// of their own, one after the other.
+//
+// The cost of a tile varies a lot over an image: empty space is nearly
+// free, while the lit limb of a planet with its reflections costs many
+// times the average. With the cost schedule of the settings, a pre-pass
+// first traces one sample of every COST_PROBE_SPACING-th pixel in both
+// directions and times it, which predicts the cost of every part of the
+// image. Tiles predicted to cost more than a small share of the work of a
+// thread are then split into quarters, down to the spacing of the probes,
+// and the tiles of every group are handed out most expensive first. Since
+// the pool hands out one tile at a time, the cheap tiles at the end fill in
+// around the expensive ones and the threads finish close together.
+//
+// Views whose renderers have a dependency map keep the tiles of their
+// last frame that depend on nothing that changed, and only trace the rest.
+//
+// Every pixel is traced by the integrator of the settings, and comes out
+// the same as when its view is rendered alone.
+class MultiViewRenderer {
+public:
+    MultiViewRenderer();
+
+    // add a view traced by renderer into framebuffer. every framebuffer must
+    // cover the same window of an image of the same size.
+    void add(const Renderer& renderer, Framebuffer& framebuffer);
+
+    inline int views() const { return m_views.size(); }
+
+    // number of groups of coherent views, once rendered
+    inline int groups() const { return m_groups; }
+
+    // trace all pixels of every view. with progress, the share of tiles
+    // done is printed as rendering goes on.
+    void render(WorkerPool& pool, bool progress = false);
+
+    // shadow cache statistics of a view from the last render, over the cost
+    // probes as well as the tiles
+    inline long long shadowLookups(int view) const { return m_views[view].lookups; }
+    inline long long shadowHits(int view) const { return m_views[view].hits; }
+
+    // with the cost schedule, the tiles traced in the last render, the time
+    // taken by the pre-pass, and the sums of the predicted and the measured
+    // time of the tiles, in seconds of a single thread
+    inline int tiles() const { return m_tiles; }
+    inline double probeTime() const { return m_probeTime; }
+    inline double predictedCost() const { return m_predictedCost; }
+    inline double actualCost() const { return m_actualCost; }
+
+    // the sum of the differences between the predicted and the measured
+    // time of every tile, relative to the measured time of all tiles, with
+    // the predictions scaled to the measured total
+    inline double costError() const { return m_costError; }
+
+private:
+    class TileTask;
+    class ProbeTask;
+
+    struct View {
+        const Renderer* renderer;
+        Framebuffer* framebuffer;
+        long long lookups;
+        long long hits;
+        // the predicted cost of the pixels around every probe
+        std::vector<double> probes;
+        int probesX;
+    };
+
+    MultiViewRenderer(const MultiViewRenderer&);
+    MultiViewRenderer& operator=(const MultiViewRenderer&);
+
+    std::vector<View> m_views;
+    int m_groups;
+    int m_tiles;
+    double m_probeTime;
+    double m_predictedCost;
+    double m_actualCost;
+    double m_costError;
+};
+
+#endif // __MULTIVIEW_H_
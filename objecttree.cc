@@ -0,0 +1,139 @@
+#include <algorithm>
+
+#include "objecttree.h"
+
+using namespace std;
+
+// orders object indices by the center of their box along one axis
+class ObjectAxisOrder {
+public:
+    ObjectAxisOrder(const vector<vec3>& lo, const vector<vec3>& hi, int axis)
+        : m_lo(lo), m_hi(hi), m_axis(axis) {}
+
+    bool operator()(int a, int b) const {
+        return center(a) < center(b);
+    }
+
+private:
+    double center(int i) const {
+        vec3 c = m_lo[i] + m_hi[i];
+        return m_axis == 0 ? c.x() : (m_axis == 1 ? c.y() : c.z());
+    }
+
+    const vector<vec3>& m_lo;
+    const vector<vec3>& m_hi;
+    int m_axis;
+};
+
+static vec3 minimum(const vec3& a, const vec3& b)
+{
+    return vec3(min(a.x(), b.x()), min(a.y(), b.y()), min(a.z(), b.z()));
+}
+
+static vec3 maximum(const vec3& a, const vec3& b)
+{
+    return vec3(max(a.x(), b.x()), max(a.y(), b.y()), max(a.z(), b.z()));
+}
+
+ObjectTree::ObjectTree()
+    : m_objects(0),
+      m_builtArea(0.0)
+{
+}
+
+void ObjectTree::build(const vector<vec3>& lo, const vector<vec3>& hi)
+{
+    m_nodes.clear();
+    m_objects = lo.size();
+    m_builtArea = 0.0;
+    if (lo.empty()) {
+        return;
+    }
+
+    vector<int> objects;
+    for (int i = 0; i < m_objects; i++) {
+        objects.push_back(i);
+    }
+
+    m_nodes.reserve(2 * m_objects);
+    build(objects, lo, hi, 0, m_objects);
+    m_builtArea = area(m_nodes[0].lo, m_nodes[0].hi);
+}
+
+int ObjectTree::build(vector<int>& objects,
+                      const vector<vec3>& lo,
+                      const vector<vec3>& hi,
+                      int begin,
+                      int end)
+{
+    int index = m_nodes.size();
+    m_nodes.push_back(Node());
+
+    Node node;
+    node.lo = lo[objects[begin]];
+    node.hi = hi[objects[begin]];
+    for (int i = begin + 1; i < end; i++) {
+        node.lo = minimum(node.lo, lo[objects[i]]);
+        node.hi = maximum(node.hi, hi[objects[i]]);
+    }
+
+    if (end - begin == 1) {
+        node.left = objects[begin];
+        node.right = -1;
+        m_nodes[index] = node;
+        return index;
+    }
+
+    // split at the median along the longest axis of the bounds
+    vec3 extent = node.hi - node.lo;
+    int axis = 0;
+    if (extent.y() > extent.x()) {
+        axis = 1;
+    }
+    if (extent.z() > (axis == 0 ? extent.x() : extent.y())) {
+        axis = 2;
+    }
+
+    int middle = begin + (end - begin) / 2;
+    nth_element(objects.begin() + begin,
+                objects.begin() + middle,
+                objects.begin() + end,
+                ObjectAxisOrder(lo, hi, axis));
+
+    node.left = build(objects, lo, hi, begin, middle);
+    node.right = build(objects, lo, hi, middle, end);
+    m_nodes[index] = node;
+
+    return index;
+}
+
+void ObjectTree::refit(const vector<vec3>& lo, const vector<vec3>& hi)
+{
+    // children come after their parents, so walking backwards updates
+    // every child before its parent
+    for (int i = m_nodes.size() - 1; i >= 0; i--) {
+        Node& node = m_nodes[i];
+        if (node.right == -1) {
+            node.lo = lo[node.left];
+            node.hi = hi[node.left];
+        } else {
+            node.lo = minimum(m_nodes[node.left].lo, m_nodes[node.right].lo);
+            node.hi = maximum(m_nodes[node.left].hi, m_nodes[node.right].hi);
+        }
+    }
+}
+
+double ObjectTree::growth() const
+{
+    if (m_nodes.empty() || m_builtArea <= 0.0) {
+        return 1.0;
+    }
+
+    return area(m_nodes[0].lo, m_nodes[0].hi) / m_builtArea;
+}
+
+double ObjectTree::area(const vec3& lo, const vec3& hi)
+{
+    vec3 e = hi - lo;
+    return 2.0 * (e.x() * e.y() + e.y() * e.z() + e.z() * e.x());
+}
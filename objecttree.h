@@ -0,0 +1,161 @@
+#ifndef __OBJECTTREE_H_
+#define __OBJECTTREE_H_
+
+#include <vector>
+#include <algorithm>
+
+#include "vec3.h"
+
+// The top level of the scene's two-level acceleration structure: a
+// bounding volume hierarchy over the world space boxes of whole objects.
+// The bottom level is each object in its own space, a primitive or an
+// instanced surface, which does not change when the object moves.
+//
+// When objects move between frames but the set of objects stays the same,
+// the tree keeps its shape and only the boxes of its nodes are refit to
+// the new object boxes, which is far cheaper than a new build. The boxes
+// of a refit tree overlap more as objects drift from where they were at
+// the build, so it reports how much its root has grown since.
+class ObjectTree {
+public:
+    ObjectTree();
+
+    // build a tree over the boxes of the objects, given by index
+    void build(const std::vector<vec3>& lo, const std::vector<vec3>& hi);
+
+    // update the boxes of the tree to moved objects. there must be as many
+    // objects as the tree was built for.
+    void refit(const std::vector<vec3>& lo, const std::vector<vec3>& hi);
+
+    inline int objects() const { return m_objects; }
+
+    // surface area of the root box over its area at the last build
+    double growth() const;
+
+    // call visit(object, maxTime) for the objects whose boxes the ray
+    // enters before maxTime, nearer boxes first. visit may lower maxTime
+    // to prune farther boxes, and returns true to stop the walk.
+    template<class Visitor>
+    void traverse(const vec3& origin,
+                  const vec3& ray,
+                  double& maxTime,
+                  Visitor& visit) const;
+
+private:
+    struct Node {
+        vec3 lo;
+        vec3 hi;
+        // children for interior nodes, or the object index and -1 for
+        // leaves. children always come after their parent.
+        int left;
+        int right;
+    };
+
+    int build(std::vector<int>& objects,
+              const std::vector<vec3>& lo,
+              const std::vector<vec3>& hi,
+              int begin,
+              int end);
+
+    // the time at which the ray enters the box of a node, if before maxTime
+    static inline bool enter(const Node& node,
+                             const vec3& origin,
+                             const vec3& inverse,
+                             double maxTime,
+                             double& time);
+
+    static double area(const vec3& lo, const vec3& hi);
+
+    std::vector<Node> m_nodes;
+    int m_objects;
+    double m_builtArea;
+};
+
+inline bool ObjectTree::enter(const Node& node,
+                              const vec3& origin,
+                              const vec3& inverse,
+                              double maxTime,
+                              double& time)
+{
+    double t0 = (node.lo.x() - origin.x()) * inverse.x(),
+           t1 = (node.hi.x() - origin.x()) * inverse.x();
+    double near = std::min(t0, t1), far = std::max(t0, t1);
+
+    t0 = (node.lo.y() - origin.y()) * inverse.y();
+    t1 = (node.hi.y() - origin.y()) * inverse.y();
+    near = std::max(near, std::min(t0, t1));
+    far = std::min(far, std::max(t0, t1));
+
+    t0 = (node.lo.z() - origin.z()) * inverse.z();
+    t1 = (node.hi.z() - origin.z()) * inverse.z();
+    near = std::max(near, std::min(t0, t1));
+    far = std::min(far, std::max(t0, t1));
+
+    // boxes behind the origin are not skipped, since the triangle test
+    // reports hits at negative times as well
+    time = near;
+    return near <= far && near < maxTime;
+}
+
+template<class Visitor>
+void ObjectTree::traverse(const vec3& origin,
+                          const vec3& ray,
+                          double& maxTime,
+                          Visitor& visit) const
+{
+    if (m_nodes.empty()) {
+        return;
+    }
+
+    // rays parallel to a slab get infinite slopes, which the min and max
+    // above sort out as long as the origin is not on the slab itself
+    vec3 inverse(1.0 / ray.x(), 1.0 / ray.y(), 1.0 / ray.z());
+
+    int stack[64];
+    double times[64];
+    int size = 0;
+
+    double time;
+    if (!enter(m_nodes[0], origin, inverse, maxTime, time)) {
+        return;
+    }
+    stack[size] = 0;
+    times[size++] = time;
+
+    while (size > 0) {
+        size--;
+        if (times[size] >= maxTime) {
+            continue;
+        }
+
+        const Node& node = m_nodes[stack[size]];
+        if (node.right == -1) {
+            if (visit(node.left, maxTime)) {
+                return;
+            }
+            continue;
+        }
+
+        double leftTime, rightTime;
+        bool left = enter(m_nodes[node.left], origin, inverse, maxTime, leftTime);
+        bool right = enter(m_nodes[node.right], origin, inverse, maxTime, rightTime);
+
+        // push the farther child first, so that the nearer one is visited
+        // first and lowers maxTime for the other
+        if (left && right) {
+            bool leftFirst = leftTime <= rightTime;
+            stack[size] = leftFirst ? node.right : node.left;
+            times[size++] = leftFirst ? rightTime : leftTime;
+            stack[size] = leftFirst ? node.left : node.right;
+            times[size++] = leftFirst ? leftTime : rightTime;
+        } else if (left) {
+            stack[size] = node.left;
+            times[size++] = leftTime;
+        } else if (right) {
+            stack[size] = node.right;
+            times[size++] = rightTime;
+        }
+    }
+}
+
+#endif // __OBJECTTREE_H_
@@ -0,0 +1,283 @@
+#include <cerrno>
+#include <cstring>
+#include <chrono>
+#include <iomanip>
+#include <mutex>
+#include <vector>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#include "profiler.h"
+
+using namespace std;
+
+// the events counted for every stage
+enum ProfileEvent {
+    EVENT_TIME,
+    EVENT_CYCLES,
+    EVENT_INSTRUCTIONS,
+    EVENT_CACHE_MISSES,
+    EVENT_BRANCH_MISSES,
+    PROFILE_EVENTS
+};
+
+static const char* s_stageNames[PROFILE_STAGES] = {
+    "camera", "intersect", "texture", "shading", "shadow", "atmosphere", "sort", "output"
+};
+
+static const char* s_eventNames[PROFILE_EVENTS] = {
+    "ms", "cycles", "instructions", "LLC misses", "branch misses"
+};
+
+// the hardware events, in the order they are read from their group
+static const unsigned long long s_hardwareEvents[] = {
+    PERF_COUNT_HW_CPU_CYCLES,
+    PERF_COUNT_HW_INSTRUCTIONS,
+    PERF_COUNT_HW_CACHE_MISSES,
+    PERF_COUNT_HW_BRANCH_MISSES
+};
+
+bool g_profiling = false;
+
+// the counters of one thread, and what they counted for every stage
+struct ThreadProfile {
+    ThreadProfile();
+
+    // read the counters, and add what they counted since the last read to
+    // stage, or to nothing if it is PROFILE_STAGES
+    void mark(int stage);
+
+    int fds[PROFILE_EVENTS];
+    long long last[PROFILE_EVENTS];
+    long long counts[PROFILE_STAGES][PROFILE_EVENTS];
+    long long items[PROFILE_STAGES];
+
+    // the stages begun and not ended yet, innermost last
+    vector<int> stages;
+};
+
+// the profiles of all threads that began a stage. the threads of the pool
+// live as long as the process, and so do their profiles.
+static mutex s_mutex;
+static vector<ThreadProfile*> s_threads;
+
+// the error the kernel gave for the first counter it refused
+static int s_error = 0;
+
+static thread_local ThreadProfile* t_profile = NULL;
+
+void enableProfiling(bool enable)
+{
+    g_profiling = enable;
+}
+
+bool profilingEnabled()
+{
+    return g_profiling;
+}
+
+// open a counter of the calling thread on any cpu, in the group of leader
+// or as a group of its own if leader is -1
+static int openCounter(unsigned int type, unsigned long long config, int leader)
+{
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = type;
+    attr.config = config;
+    attr.read_format = PERF_FORMAT_GROUP;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+
+    int fd = syscall(SYS_perf_event_open, &attr, 0, -1, leader, 0);
+    if (fd < 0) {
+        lock_guard<mutex> lock(s_mutex);
+        if (s_error == 0) {
+            s_error = errno;
+        }
+    }
+    return fd;
+}
+
+// read the values of a group of counters, and return how many were read
+static int readGroup(int fd, unsigned long long* values, int count)
+{
+    unsigned long long buffer[1 + PROFILE_EVENTS];
+    ssize_t size = read(fd, buffer, sizeof(buffer));
+    if (size < (ssize_t)sizeof(buffer[0])) {
+        return 0;
+    }
+
+    int n = min((int)buffer[0], min(count, (int)(size / sizeof(buffer[0])) - 1));
+    for (int i = 0; i < n; i++) {
+        values[i] = buffer[1 + i];
+    }
+    return n;
+}
+
+ThreadProfile::ThreadProfile()
+{
+    memset(last, 0, sizeof(last));
+    memset(counts, 0, sizeof(counts));
+    memset(items, 0, sizeof(items));
+
+    fds[EVENT_TIME] = openCounter(PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK, -1);
+
+    // the hardware counters are read together through the first of them
+    // that opens
+    int leader = -1;
+    for (int e = EVENT_CYCLES; e < PROFILE_EVENTS; e++) {
+        fds[e] = openCounter(PERF_TYPE_HARDWARE, s_hardwareEvents[e - EVENT_CYCLES], leader);
+        if (leader < 0) {
+            leader = fds[e];
+        }
+    }
+
+    mark(PROFILE_STAGES);
+}
+
+void ThreadProfile::mark(int stage)
+{
+    long long now[PROFILE_EVENTS];
+    unsigned long long values[PROFILE_EVENTS];
+
+    if (fds[EVENT_TIME] >= 0 && readGroup(fds[EVENT_TIME], values, 1) == 1) {
+        now[EVENT_TIME] = values[0];
+    } else {
+        now[EVENT_TIME] = chrono::duration_cast<chrono::nanoseconds>(
+            chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    // the group holds the hardware counters that opened, in order
+    int leader = -1;
+    for (int e = EVENT_CYCLES; e < PROFILE_EVENTS && leader < 0; e++) {
+        leader = fds[e];
+    }
+    int read = leader >= 0 ? readGroup(leader, values, PROFILE_EVENTS - EVENT_CYCLES) : 0;
+    for (int e = EVENT_CYCLES, i = 0; e < PROFILE_EVENTS; e++) {
+        if (fds[e] >= 0) {
+            now[e] = i < read ? values[i] : last[e];
+            i++;
+        } else {
+            now[e] = 0;
+        }
+    }
+
+    for (int e = 0; e < PROFILE_EVENTS; e++) {
+        if (stage < PROFILE_STAGES) {
+            counts[stage][e] += now[e] - last[e];
+        }
+        last[e] = now[e];
+    }
+}
+
+// the profile of the calling thread, opening its counters the first time
+static ThreadProfile* threadProfile()
+{
+    if (t_profile == NULL) {
+        t_profile = new ThreadProfile();
+        lock_guard<mutex> lock(s_mutex);
+        s_threads.push_back(t_profile);
+    }
+    return t_profile;
+}
+
+void ProfileScope::beginStage(ProfileStage stage, long long items)
+{
+    ThreadProfile* profile = threadProfile();
+    profile->mark(profile->stages.empty() ? PROFILE_STAGES : profile->stages.back());
+    profile->stages.push_back(stage);
+    profile->items[stage] += items;
+}
+
+void ProfileScope::endStage()
+{
+    ThreadProfile* profile = threadProfile();
+    profile->mark(profile->stages.back());
+    profile->stages.pop_back();
+}
+
+void reportProfile(ostream& out)
+{
+    lock_guard<mutex> lock(s_mutex);
+
+    // sum the threads. every thread opens the same counters.
+    long long counts[PROFILE_STAGES][PROFILE_EVENTS];
+    long long items[PROFILE_STAGES];
+    bool available[PROFILE_EVENTS];
+    memset(counts, 0, sizeof(counts));
+    memset(items, 0, sizeof(items));
+    for (int e = 0; e < PROFILE_EVENTS; e++) {
+        available[e] = e == EVENT_TIME;
+    }
+
+    for (vector<ThreadProfile*>::iterator thread = s_threads.begin();
+         thread != s_threads.end();
+         thread++) {
+
+        for (int e = 0; e < PROFILE_EVENTS; e++) {
+            available[e] = available[e] || (*thread)->fds[e] >= 0;
+        }
+        for (int s = 0; s < PROFILE_STAGES; s++) {
+            items[s] += (*thread)->items[s];
+            for (int e = 0; e < PROFILE_EVENTS; e++) {
+                counts[s][e] += (*thread)->counts[s][e];
+            }
+        }
+    }
+
+    out << "profile on " << s_threads.size() << (s_threads.size() == 1 ? " thread" : " threads")
+        << ", counting";
+    bool any = false;
+    for (int e = 0; e < PROFILE_EVENTS; e++) {
+        if (available[e]) {
+            out << (any ? ", " : " ") << s_eventNames[e];
+            any = true;
+        }
+    }
+    if (s_error != 0) {
+        out << " (some counters unavailable: " << strerror(s_error) << ")";
+    }
+    out << endl;
+
+    long long rays = items[PROFILE_INTERSECT] + items[PROFILE_SHADOW];
+    double perRays = rays > 0 ? 1e6 / rays : 0.0;
+
+    // the time is counted in ns and shown in ms
+    streamsize precision = out.precision();
+    out << "  " << setw(10) << left << "stage" << right << setw(12) << "rays/pixels";
+    for (int e = 0; e < PROFILE_EVENTS; e++) {
+        if (available[e]) {
+            out << setw(22) << (string(s_eventNames[e]) + "/Mray");
+        }
+    }
+    out << endl;
+
+    for (int s = 0; s < PROFILE_STAGES; s++) {
+        out << "  " << setw(10) << left << s_stageNames[s] << right << setw(12) << items[s];
+        for (int e = 0; e < PROFILE_EVENTS; e++) {
+            if (available[e]) {
+                double scale = e == EVENT_TIME ? 1e-6 : 1.0;
+                out << setw(22) << fixed << setprecision(e == EVENT_TIME ? 3 : 0)
+                    << counts[s][e] * scale * perRays;
+            }
+        }
+        out << endl;
+    }
+    out.unsetf(ios::fixed);
+    out.precision(precision);
+    out << "  " << rays << " rays" << endl;
+}
+
+void resetProfile()
+{
+    lock_guard<mutex> lock(s_mutex);
+    for (vector<ThreadProfile*>::iterator thread = s_threads.begin();
+         thread != s_threads.end();
+         thread++) {
+
+        memset((*thread)->counts, 0, sizeof((*thread)->counts));
+        memset((*thread)->items, 0, sizeof((*thread)->items));
+    }
+}
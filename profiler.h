@@ -0,0 +1,96 @@
+#ifndef __PROFILER_H_
+#define __PROFILER_H_
+
+#include <iostream>
+
+// The stages of tracing a frame that the profiler tells apart
+enum ProfileStage {
+    // generating the camera rays
+    PROFILE_CAMERA,
+    // finding the closest hits of rays
+    PROFILE_INTERSECT,
+    // looking up the materials of hits, which reads the maps of planets
+    PROFILE_TEXTURE,
+    // ambient light, picking lights, shading the visible ones and
+    // reflecting
+    PROFILE_SHADING,
+    // tracing shadow rays
+    PROFILE_SHADOW,
+    // scattering and dimming light in the atmospheres along rays
+    PROFILE_ATMOSPHERE,
+    // sorting the batches of the wavefront integrator
+    PROFILE_SORT,
+    // writing the pixels into an image
+    PROFILE_OUTPUT,
+    PROFILE_STAGES
+};
+
+// Counts the work of every stage with the performance counters of Linux,
+// opened through perf_event_open for each thread that traces: cycles,
+// instructions, misses of the last level cache and mispredicted branches,
+// along with the cpu time of the thread from its task clock. The counters
+// are read when a stage begins and ends, and what a nested stage counts is
+// taken out of the stage around it.
+//
+// The stages are counted in the methods of Renderer that both integrators
+// trace with, one call at a time, so the recursive and the wavefront
+// integrator can be compared stage by stage. A read of the counters is a
+// system call that can cost as much as the call it measures, and is
+// counted against the stage it ends, so the totals with profiling are
+// well above those without. Work of an integrator that belongs to no
+// stage, such as keeping its paths, is not counted.
+//
+// Counters the kernel or the hardware does not offer, such as those of a
+// virtual machine without a PMU or under a strict perf_event_paranoid,
+// are reported as unavailable, and the time falls back to the wall clock
+// if even the task clock cannot be opened.
+
+// turn profiling on or off. must be set before any thread starts a stage.
+void enableProfiling(bool enable);
+bool profilingEnabled();
+
+// whether profiling is on, checked by every scope
+extern bool g_profiling;
+
+// counts the work between its construction and destruction against a
+// stage, which handles the given number of rays or pixels
+class ProfileScope {
+public:
+    inline ProfileScope(ProfileStage stage, long long items)
+        : m_active(g_profiling) {
+        if (m_active) {
+            beginStage(stage, items);
+        }
+    }
+
+    inline ~ProfileScope() {
+        end();
+    }
+
+    // stop counting before the scope is left
+    inline void end() {
+        if (m_active) {
+            endStage();
+            m_active = false;
+        }
+    }
+
+private:
+    ProfileScope(const ProfileScope&);
+    ProfileScope& operator=(const ProfileScope&);
+
+    static void beginStage(ProfileStage stage, long long items);
+    static void endStage();
+
+    bool m_active;
+};
+
+// print what every stage counted on all threads since the last reset, in
+// total and per million rays, where the rays are those intersected and
+// the shadow rays
+void reportProfile(std::ostream& out);
+
+// start counting from zero on all threads
+void resetProfile();
+
+#endif // __PROFILER_H_
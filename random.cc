@@ -28,3 +28,22 @@ RandomDoubles::~RandomDoubles()
 {
     delete[] m_values;
 }
+
+SampleStream::SampleStream()
+    : m_table(NULL),
+      m_index(0)
+{
+}
+
+SampleStream::SampleStream(const RandomDoubles& table, unsigned long long key)
+    : m_table(&table),
+      m_index(0)
+{
+    // scramble the key so that neighbouring samples start far apart
+    key += 0x9E3779B97F4A7C15ULL;
+    key = (key ^ (key >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    key = (key ^ (key >> 27)) * 0x94D049BB133111EBULL;
+    key = key ^ (key >> 31);
+
+    m_index = key % table.count();
+}
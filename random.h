@@ -7,10 +7,35 @@ public:
     ~RandomDoubles();
 
     double next();
+
+    inline int count() const { return m_count; }
+    inline double at(int index) const { return m_values[index]; }
 private:
     int m_count;
     int m_index;
     double* m_values;
 };
 
+// A sequence of numbers read from a RandomDoubles table, starting at a
+// position derived from a key. Keying the sequence on the sample it is used
+// for makes the result of a sample independent of the order in which
+// samples are traced. The stream is small enough to be copied along with
+// the ray it belongs to.
+class SampleStream {
+public:
+    SampleStream();
+    SampleStream(const RandomDoubles& table, unsigned long long key);
+
+    inline double next() {
+        if (m_index >= m_table->count()) {
+            m_index = 0;
+        }
+
+        return m_table->at(m_index++);
+    }
+private:
+    const RandomDoubles* m_table;
+    int m_index;
+};
+
 #endif // __RANDOM_H_
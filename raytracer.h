@@ -3,4 +3,14 @@
 
 #define EPSILON 0.000001
 
+// upper limit on the number of lights sampled per shading point
+#define MAX_LIGHT_SAMPLES 16
+
+// bounded objects a scene needs before rays walk a tree over them rather
+// than testing them all in turn
+#define MIN_TREE_OBJECTS 8
+
+// how much the root of a refit object tree may grow before it is rebuilt
+#define MAX_TREE_GROWTH 2.0
+
 #endif // __RAYTRACER_H
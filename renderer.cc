@@ -0,0 +1,495 @@
+#include <algorithm>
+#include <cmath>
+#include <ctime>
+#include <limits>
+
+#include "raytracer.h"
+#include "renderer.h"
+#include "profiler.h"
+
+using namespace std;
+
+RenderSettings::RenderSettings()
+    : imageWidth(2560),
+      imageHeight(1440),
+      screenWidth(100.0),
+      screenHeight((imageHeight * screenWidth) / imageWidth),
+      distanceToScreen(100.0),
+      samples(100),
+      lightSamples(4),
+      maxReflectionSteps(10),
+      minColorIntensity(1.0 / 256.0),
+      ambientColor(1.0, 1.0, 1.0),
+      radianceScale(1.0),
+      seed(time(NULL)),
+      wavefront(false),
+      denoise(false),
+      binCameraHits(false),
+      tileOrder(TILE_ROWS),
+      costSchedule(false),
+      gbufferBudget(512 << 20),
+      lightingCacheResolution(0)
+{
+}
+
+Renderer::Renderer(const RenderSettings& settings,
+                   const Scene& scene,
+                   const vector<LightSource>& lights,
+                   const Camera& camera,
+                   const RandomDoubles& random)
+    : m_settings(settings),
+      m_scene(scene),
+      m_lights(lights),
+      m_camera(camera),
+      m_random(random),
+      m_lightTree(lights),
+      m_gbuffer(NULL),
+      m_lightingCache(NULL),
+      m_dependencyMap(NULL),
+      m_sampleLights((int)lights.size() > min(settings.lightSamples, MAX_LIGHT_SAMPLES)),
+      m_lightSamples(m_sampleLights ? min(settings.lightSamples, MAX_LIGHT_SAMPLES)
+                                    : lights.size()),
+      m_sampleGrid(ceil(sqrt(settings.samples)))
+{
+}
+
+void Renderer::render(Framebuffer& framebuffer,
+                      int x0,
+                      int y0,
+                      int x1,
+                      int y1,
+                      ShadowCache& shadowCache,
+                      Dependencies* dependencies) const
+{
+    // in rows, the order of the pixels in the framebuffer
+    for (int y = y0; y < y1; y++) {
+        for (int x = x0; x < x1; x++) {
+            Color pixel;
+            if (framebuffer.hasFeatures()) {
+                PixelFeatures features;
+                for (int sample = 0; sample < sampleCount(); sample++) {
+                    PixelFeatures sampleFeatures;
+                    pixel += traceSample(x, y, sample, shadowCache, &sampleFeatures, dependencies);
+                    features.add(sampleFeatures);
+                }
+
+                features.average(sampleCount());
+                framebuffer.features(x, y) = features;
+            } else {
+                for (int sample = 0; sample < sampleCount(); sample++) {
+                    pixel += traceSample(x, y, sample, shadowCache, NULL, dependencies);
+                }
+            }
+
+            framebuffer.at(x, y) = pixelColor(pixel);
+        }
+    }
+}
+
+Color Renderer::traceSample(int x,
+                            int y,
+                            int sample,
+                            ShadowCache& shadowCache,
+                            PixelFeatures* features,
+                            Dependencies* dependencies) const
+{
+    SampleStream stream = sampleStream(x, y, sample);
+
+    Color radiance;
+    vec3 d = cameraRay(x, y, sample, stream);
+    vec3 f(m_settings.radianceScale, m_settings.radianceScale, m_settings.radianceScale);
+    vec3 o = m_camera.eye();
+
+    LightSample lightSamples[MAX_LIGHT_SAMPLES];
+    LightShading lights[MAX_LIGHT_SAMPLES];
+    for (int k = 0; k < m_settings.maxReflectionSteps; k++) {
+
+        // find the object closest to the eye
+        Intersection hit;
+        bool found;
+        if (k == 0) {
+            found = primaryHit(x, y, sample, d, hit);
+        } else {
+            found = intersect(o, d, hit);
+        }
+        if (found) {
+            applyMaterial(hit);
+        }
+
+        shadeAtmosphere(o,
+                        d,
+                        found ? hit.time() : numeric_limits<double>::infinity(),
+                        f,
+                        radiance);
+        if (!found) {
+            break;
+        }
+
+        if (k == 0 && features != NULL) {
+            *features = sampleFeatures(hit);
+        }
+        if (dependencies != NULL) {
+            dependencies->addSurface(hit.surface());
+        }
+
+        shadeAmbient(d, f, hit, radiance);
+
+        // shade the visible lights together, with the kernel of the material
+        int count = sampleLights(hit, stream, lightSamples, dependencies);
+        int shaded = 0;
+        for (int i = 0; i < count; i++) {
+            if (visible(hit, lightSamples[i], shadowCache)) {
+                LightShading& light = lights[shaded++];
+                light.ray = &d;
+                light.throughput = &f;
+                light.hit = &hit;
+                light.sample = &lightSamples[i];
+                light.radiance = &radiance;
+            }
+        }
+        shadeLights(shadingKernel(hit.material()), lights, shaded);
+
+        if (!reflect(hit, f, o, d)) {
+            break;
+        }
+    }
+
+    return radiance;
+}
+
+PixelFeatures Renderer::sampleFeatures(const Intersection& hit) const
+{
+    PixelFeatures features;
+    features.albedo = hit.material().diffuseColor();
+    features.normal = hit.normal();
+    features.depth = hit.time();
+    features.coverage = 1.0;
+    return features;
+}
+
+SampleStream Renderer::sampleStream(int x, int y, int sample) const
+{
+    unsigned long long pixel = (unsigned long long)y * m_settings.imageWidth + x;
+    return SampleStream(m_random, pixel * sampleCount() + sample);
+}
+
+vec3 Renderer::cameraRay(int x, int y, int sample, SampleStream& stream) const
+{
+    ProfileScope profile(PROFILE_CAMERA, 1);
+    const RenderSettings& s = m_settings;
+    double inverseGrid = 1.0 / sqrt(s.samples);
+    int i = sample / m_sampleGrid, j = sample % m_sampleGrid;
+
+    // introduce some randomness
+    double b = y + inverseGrid * i;
+    if (s.samples == 1) {
+        b += 0.5;
+    } else {
+        b += stream.next();
+    }
+
+    b = s.screenWidth / s.imageWidth * (s.imageHeight / 2.0 - b);
+
+    double a = x + inverseGrid * j;
+    if (s.samples == 1) {
+        a += 0.5;
+    } else {
+        a += stream.next();
+    }
+
+    a = s.screenWidth / s.imageWidth * (a - s.imageWidth / 2.0);
+
+    return m_camera.ray(a, b);
+}
+
+bool Renderer::primaryHit(int x,
+                          int y,
+                          int sample,
+                          const vec3& ray,
+                          Intersection& hit) const
+{
+    ProfileScope profile(PROFILE_INTERSECT, 1);
+    const vec3& eye = m_camera.eye();
+    if (m_gbuffer == NULL || !m_gbuffer->holds(sample)) {
+        return m_scene.intersectGeometry(eye, ray, numeric_limits<double>::infinity(), hit);
+    }
+
+    int surface;
+    double time;
+    if (m_gbuffer->lookup(x, y, sample, surface, time)) {
+        return surface >= 0 && m_scene.hitSurface(surface, eye, ray, time, hit);
+    }
+
+    bool found = m_scene.intersectGeometry(eye, ray, numeric_limits<double>::infinity(), hit);
+    m_gbuffer->store(x, y, sample, found ? hit.surface() : -1, hit.time());
+    return found;
+}
+
+bool Renderer::intersect(const vec3& origin, const vec3& ray, Intersection& hit) const
+{
+    ProfileScope profile(PROFILE_INTERSECT, 1);
+    return m_scene.intersectGeometry(origin, ray, numeric_limits<double>::infinity(), hit);
+}
+
+void Renderer::applyMaterial(Intersection& hit) const
+{
+    ProfileScope profile(PROFILE_TEXTURE, 1);
+    m_scene.applyMaterial(hit);
+}
+
+void Renderer::applyMaterials(Intersection* hits, const int* indices, int count) const
+{
+    ProfileScope profile(PROFILE_TEXTURE, count);
+    m_scene.applyMaterials(hits, indices, count);
+}
+
+void Renderer::shadeAtmosphere(const vec3& origin,
+                               const vec3& ray,
+                               double time,
+                               vec3& throughput,
+                               Color& radiance) const
+{
+    const vector<Scene::AtmosphereShell>& shells = m_scene.atmospheres();
+    if (shells.empty()) {
+        return;
+    }
+
+    ProfileScope profile(PROFILE_ATMOSPHERE, 1);
+    for (vector<Scene::AtmosphereShell>::const_iterator shell = shells.begin();
+         shell != shells.end();
+         shell++) {
+
+        // the tables are in km, around a planet at the origin
+        const Atmosphere& atmosphere = *shell->atmosphere;
+        double scale = atmosphere.parameters().groundRadius / shell->radius;
+        vec3 x = scale * (origin - shell->center);
+        double t0, t1;
+        if (!atmosphere.enter(x, ray, t0, t1)) {
+            continue;
+        }
+
+        t1 = min(t1, scale * time);
+        if (t1 <= t0) {
+            continue;
+        }
+
+        // the diffuse term has no 1/pi, so the irradiance of a light is pi
+        // times its color
+        for (vector<LightSource>::const_iterator light = m_lights.begin();
+             light != m_lights.end();
+             light++) {
+
+            vec3 sun = (light->location() - shell->center).normalize();
+            Color transmittance;
+            Color scattered = atmosphere.scattering(x, ray, sun, t0, t1, transmittance);
+            radiance += M_PI * throughput.mul(light->color().mul(scattered));
+        }
+
+        throughput = throughput.mul(atmosphere.transmittance(x, ray, t0, t1));
+    }
+}
+
+void Renderer::shadeAmbient(const vec3& ray,
+                            const vec3& throughput,
+                            Intersection& hit,
+                            Color& radiance) const
+{
+    ProfileScope profile(PROFILE_SHADING, 1);
+    const Material& material = hit.material();
+    if (material.ambientWeight() > 0.0) {
+        radiance += material.ambientWeight()
+                  * throughput.mul(m_settings.ambientColor.mul(material.ambientColor()));
+    }
+
+    if (ray.dot(hit.normal()) >= 0) {
+        // negate the direction of the normal
+        hit.normal(-hit.normal());
+    }
+}
+
+int Renderer::sampleLights(const Intersection& hit,
+                           SampleStream& stream,
+                           LightSample* samples,
+                           Dependencies* dependencies) const
+{
+    ProfileScope profile(PROFILE_SHADING, 0);
+    int count = 0;
+    for (int s = 0; s < m_lightSamples; s++) {
+
+        // with many lights, pick one in proportion to its estimated
+        // contribution and weight it by the inverse probability, so that
+        // the sum over all lights is still estimated without bias
+        int index = s;
+        double weight = 1.0;
+        if (m_sampleLights) {
+            double pdf;
+            index = m_lightTree.sample(hit.hit(), hit.normal(), stream.next(), pdf);
+            // a draw that finds no light adds nothing, and the others
+            // are still made
+            if (index < 0) {
+                continue;
+            }
+
+            weight = 1.0 / (pdf * m_lightSamples);
+        }
+
+        // a light behind the surface still decides the pixel, as moving
+        // it could light the hit
+        if (dependencies != NULL) {
+            dependencies->addLight(index);
+        }
+
+        const LightSource& light = m_lights[index];
+        double r1 = (stream.next() - 0.5) * light.radius(),
+               r2 = (stream.next() - 0.5) * light.radius(),
+               r3 = (stream.next() - 0.5) * light.radius();
+        const vec3& lightLoc = light.location() + vec3(r1, r2, r3);
+
+        vec3 l = (lightLoc - hit.hit()).normalize();
+
+        double nDotl = l.dot(hit.normal());
+        if (nDotl <= 0) {
+            continue;
+        }
+
+        LightSample& sample = samples[count++];
+        sample.light = index;
+        sample.weight = weight;
+        sample.direction = l;
+        sample.distance = (lightLoc - hit.hit()).abs();
+        sample.nDotl = nDotl;
+        sample.color = light.color();
+
+        // sunlight is dimmed on its way through the atmospheres the point
+        // is in
+        const vector<Scene::AtmosphereShell>& shells = m_scene.atmospheres();
+        if (shells.empty()) {
+            continue;
+        }
+
+        ProfileScope atmosphereProfile(PROFILE_ATMOSPHERE, 0);
+        for (vector<Scene::AtmosphereShell>::const_iterator shell = shells.begin();
+             shell != shells.end();
+             shell++) {
+
+            const Atmosphere& atmosphere = *shell->atmosphere;
+            double scale = atmosphere.parameters().groundRadius / shell->radius;
+            vec3 x = scale * (hit.hit() - shell->center);
+            if (x.abs() < atmosphere.parameters().topRadius) {
+                vec3 color = sample.color.mul(atmosphere.sunTransmittance(x, l));
+                sample.color = Color(color.x(), color.y(), color.z());
+            }
+        }
+    }
+
+    return count;
+}
+
+bool Renderer::visible(const Intersection& hit,
+                       const LightSample& sample,
+                       ShadowCache& shadowCache) const
+{
+    ProfileScope profile(PROFILE_SHADOW, 1);
+    if (m_lightingCache == NULL) {
+        return traceShadowRay(hit, sample, shadowCache);
+    }
+
+    int cell = m_lightingCache->cell(m_scene, hit);
+    if (cell < 0) {
+        return traceShadowRay(hit, sample, shadowCache);
+    }
+
+    int cached = m_lightingCache->visible(m_scene, m_lights[sample.light], cell, sample.light);
+    if (cached >= 0) {
+        return cached;
+    }
+    return traceShadowRay(hit, sample, shadowCache);
+}
+
+bool Renderer::traceShadowRay(const Intersection& hit,
+                              const LightSample& sample,
+                              ShadowCache& shadowCache) const
+{
+    // try the surface that last shadowed this light first, since it is
+    // likely to shadow this point too
+    int occluder = shadowCache.occluder(sample.light);
+    if (occluder >= 0) {
+        bool blocked = m_scene.occludedBy(occluder,
+                                          hit.hit(),
+                                          sample.direction,
+                                          sample.distance);
+        shadowCache.lookup(blocked);
+        if (blocked) {
+            return false;
+        }
+    }
+
+    // otherwise do a second pass across all objects in the scene, and
+    // check if they shadow the object
+    if (m_scene.occluded(hit.hit(),
+                         sample.direction,
+                         sample.distance,
+                         occluder,
+                         occluder)) {
+
+        shadowCache.occluder(sample.light, occluder);
+        return false;
+    }
+
+    return true;
+}
+
+void Renderer::shadeLight(const vec3& ray,
+                          const vec3& throughput,
+                          const Intersection& hit,
+                          const LightSample& sample,
+                          Color& radiance) const
+{
+    LightShading light;
+    light.ray = &ray;
+    light.throughput = &throughput;
+    light.hit = &hit;
+    light.sample = &sample;
+    light.radiance = &radiance;
+    shadeLights(shadingKernel(hit.material()), &light, 1);
+}
+
+void Renderer::shadeLights(int kernel, const LightShading* lights, int count) const
+{
+    ProfileScope profile(PROFILE_SHADING, 0);
+    ::shadeLights(kernel, lights, count);
+}
+
+bool Renderer::reflect(const Intersection& hit,
+                       vec3& throughput,
+                       vec3& origin,
+                       vec3& ray) const
+{
+    ProfileScope profile(PROFILE_SHADING, 0);
+    const Material& material = hit.material();
+    if (material.reflectionWeight() <= 0) {
+        return false;
+    }
+
+    throughput = material.reflectionWeight()
+               * throughput.mul(material.reflectionColor());
+    if (throughput.x() < m_settings.minColorIntensity &&
+        throughput.y() < m_settings.minColorIntensity &&
+        throughput.z() < m_settings.minColorIntensity) {
+
+        return false;
+    }
+
+    const vec3& n = hit.normal();
+    ray = ray - (2.0*ray.dot(n)) * n;
+    origin = hit.hit();
+
+    return true;
+}
+
+Color Renderer::pixelColor(const Color& sum) const
+{
+    Color pixel = sum;
+    pixel /= m_settings.samples * m_lights.size();
+    return pixel;
+}
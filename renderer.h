@@ -0,0 +1,215 @@
+#ifndef __RENDERER_H_
+#define __RENDERER_H_
+
+#include <vector>
+
+#include "vec3.h"
+#include "color.h"
+#include "random.h"
+#include "lightsource.h"
+#include "lighttree.h"
+#include "surface.h"
+#include "scene.h"
+#include "camera.h"
+#include "framebuffer.h"
+#include "shadowcache.h"
+#include "gbuffer.h"
+#include "lightingcache.h"
+#include "dependencymap.h"
+#include "shading.h"
+#include "tileorder.h"
+
+// The parameters of a render
+struct RenderSettings {
+    RenderSettings();
+
+    // output size
+    int imageWidth;
+    int imageHeight;
+    // virtual screen size
+    double screenWidth;
+    double screenHeight;
+    // distance from eye to screen, in the direction towards looking_at
+    double distanceToScreen;
+    // number of samples per pixel
+    int samples;
+    // number of lights sampled per shading point once the scene has more
+    // lights than this; with fewer lights every light is sampled. at most
+    // MAX_LIGHT_SAMPLES.
+    int lightSamples;
+    // max number of reflection steps
+    int maxReflectionSteps;
+    double minColorIntensity;
+    // color of ambient light
+    Color ambientColor;
+    double radianceScale;
+    // seed of the table of random numbers
+    int seed;
+    // trace batches of rays stage by stage instead of one sample at a time
+    bool wavefront;
+    // filter the image guided by the features of the first hits
+    bool denoise;
+    // find the hits of the camera rays through bins of the surfaces on the
+    // screen, into the g-buffer before tracing
+    bool binCameraHits;
+    // the order the tiles of the image are traced in
+    TileOrder tileOrder;
+    // predict the cost of the tiles from a sparse pre-pass, and split and
+    // order the tiles by it
+    bool costSchedule;
+    // bytes kept for the hits of the camera rays, which are reused by the
+    // next frame if it has the same view and geometry
+    size_t gbufferBudget;
+    // cells across the maps of planets for caching light visibility, or 0
+    // to trace every shadow ray
+    int lightingCacheResolution;
+};
+
+// Traces the samples of an image. Every sample draws its random numbers
+// from its own SampleStream, so a pixel comes out the same regardless of
+// the order in which pixels and samples are traced. The steps of tracing
+// a sample are public, so that other integrators can run them in a
+// different order and still produce the same image.
+class Renderer {
+public:
+    Renderer(const RenderSettings& settings,
+             const Scene& scene,
+             const std::vector<LightSource>& lights,
+             const Camera& camera,
+             const RandomDoubles& random);
+
+    // trace all samples of the pixels in [x0, x1) x [y0, y1), one sample at
+    // a time and depth first through its reflections. if dependencies is
+    // given, the surfaces and lights the paths touch are added to it.
+    void render(Framebuffer& framebuffer,
+                int x0,
+                int y0,
+                int x1,
+                int y1,
+                ShadowCache& shadowCache,
+                Dependencies* dependencies = NULL) const;
+
+    // the radiance of a single sample of a pixel. if features is given, the
+    // features of the first hit are stored in it.
+    Color traceSample(int x,
+                      int y,
+                      int sample,
+                      ShadowCache& shadowCache,
+                      PixelFeatures* features = NULL,
+                      Dependencies* dependencies = NULL) const;
+
+    // the features of a sample whose first hit is hit
+    PixelFeatures sampleFeatures(const Intersection& hit) const;
+
+    // number of samples traced per pixel. the samples are laid out on a
+    // square grid, so this rounds up to the next square.
+    inline int sampleCount() const { return m_sampleGrid * m_sampleGrid; }
+
+    // the random numbers of a sample
+    SampleStream sampleStream(int x, int y, int sample) const;
+
+    // the direction of the camera ray of a sample
+    vec3 cameraRay(int x, int y, int sample, SampleStream& stream) const;
+
+    // find the closest hit of the camera ray of a sample, without its
+    // material. the hit is taken from the g-buffer when it holds it, and
+    // stored there otherwise.
+    bool primaryHit(int x, int y, int sample, const vec3& ray, Intersection& hit) const;
+
+    // find the closest hit of any other ray, without its material
+    bool intersect(const vec3& origin, const vec3& ray, Intersection& hit) const;
+
+    // look up the material of a hit, which for planets reads their maps,
+    // or of the hits at indices
+    void applyMaterial(Intersection& hit) const;
+    void applyMaterials(Intersection* hits, const int* indices, int count) const;
+
+    // add the sunlight scattered towards origin by the atmospheres along a
+    // ray up to time, which is infinite for rays that miss, and dim the
+    // throughput of the path by them
+    void shadeAtmosphere(const vec3& origin,
+                         const vec3& ray,
+                         double time,
+                         vec3& throughput,
+                         Color& radiance) const;
+
+    // turn the normal of a hit towards the ray, and add the ambient term
+    void shadeAmbient(const vec3& ray,
+                      const vec3& throughput,
+                      Intersection& hit,
+                      Color& radiance) const;
+
+    // pick the lights to sample at a hit, and return how many were picked.
+    // samples must have room for MAX_LIGHT_SAMPLES lights. every light
+    // looked at is added to dependencies, including those facing away.
+    int sampleLights(const Intersection& hit,
+                     SampleStream& stream,
+                     LightSample* samples,
+                     Dependencies* dependencies = NULL) const;
+
+    // check if nothing blocks the shadow ray of a light sample. with a
+    // lighting cache, hits on planets take the answer of their cell.
+    bool visible(const Intersection& hit,
+                 const LightSample& sample,
+                 ShadowCache& shadowCache) const;
+
+    // add the diffuse and specular terms of a visible light
+    void shadeLight(const vec3& ray,
+                    const vec3& throughput,
+                    const Intersection& hit,
+                    const LightSample& sample,
+                    Color& radiance) const;
+
+    // shadeLight() for a batch of visible lights whose hits have materials
+    // of the same shading kernel
+    void shadeLights(int kernel, const LightShading* lights, int count) const;
+
+    // continue the path in the mirror direction. returns false when the
+    // material does not reflect, or too little light would be reflected.
+    bool reflect(const Intersection& hit,
+                 vec3& throughput,
+                 vec3& origin,
+                 vec3& ray) const;
+
+    // the color of a pixel from the sum of the radiance of its samples
+    Color pixelColor(const Color& sum) const;
+
+    inline const RenderSettings& settings() const { return m_settings; }
+    inline const Scene& scene() const { return m_scene; }
+    inline const Camera& camera() const { return m_camera; }
+    inline const std::vector<LightSource>& lights() const { return m_lights; }
+
+    // the g-buffer to reuse camera hits from, or NULL to trace them all
+    inline GBuffer* gbuffer() const { return m_gbuffer; }
+    inline void gbuffer(GBuffer* gbuffer) { m_gbuffer = gbuffer; }
+
+    // the cache of light visibility on planets, or NULL to trace every
+    // shadow ray
+    inline LightingCache* lightingCache() const { return m_lightingCache; }
+    inline void lightingCache(LightingCache* cache) { m_lightingCache = cache; }
+
+    // the tiles of the last frame to keep where nothing they depend on
+    // changed, or NULL to trace every tile
+    inline DependencyMap* dependencyMap() const { return m_dependencyMap; }
+    inline void dependencyMap(DependencyMap* map) { m_dependencyMap = map; }
+
+private:
+    bool traceShadowRay(const Intersection& hit,
+                        const LightSample& sample,
+                        ShadowCache& shadowCache) const;
+
+    const RenderSettings& m_settings;
+    const Scene& m_scene;
+    const std::vector<LightSource>& m_lights;
+    const Camera& m_camera;
+    const RandomDoubles& m_random;
+    LightTree m_lightTree;
+    GBuffer* m_gbuffer;
+    LightingCache* m_lightingCache;
+    DependencyMap* m_dependencyMap;
+    bool m_sampleLights;
+    int m_lightSamples;
+    int m_sampleGrid;
+};
+
+#endif // __RENDERER_H_
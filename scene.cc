@@ -0,0 +1,1084 @@
+#include <new>
+#include <algorithm>
+#include <chrono>
+
+#include "raytracer.h"
+#include "geometry.h"
+#include "spheremap.h"
+#include "hash.h"
+#include "sphereset.h"
+#include "scene.h"
+
+using namespace std;
+
+Scene::Scene()
+    : m_spheres(NULL),
+      m_planets(NULL),
+      m_planes(NULL),
+      m_triangles(NULL),
+      m_sphereSets(NULL),
+      m_surfaces(NULL),
+      m_materials(NULL),
+      m_handles(NULL),
+      m_sphereCount(0),
+      m_planetCount(0),
+      m_planeCount(0),
+      m_triangleCount(0),
+      m_sphereSetCount(0),
+      m_surfaceCount(0),
+      m_count(0),
+      m_useTree(false),
+      m_buildTime(0.0),
+      m_refitTime(0.0)
+{
+}
+
+int Scene::add(Surface& surface)
+{
+    return surface.pack(*this);
+}
+
+int Scene::addMaterial(const Material& material)
+{
+    m_stagedMaterials.push_back(material);
+    return m_stagedMaterials.size() - 1;
+}
+
+int Scene::addHandle(Type type, int index)
+{
+    Handle handle;
+    handle.type = type;
+    handle.index = index;
+    m_stagedHandles.push_back(handle);
+    return m_stagedHandles.size() - 1;
+}
+
+int Scene::addSphere(const vec3& center, double radius, const Material& material)
+{
+    SphereRecord record;
+    record.center = center;
+    record.radius = radius;
+    record.material = addMaterial(material);
+    record.id = addHandle(SPHERE, m_stagedSpheres.size());
+    m_stagedSpheres.push_back(record);
+    return record.id;
+}
+
+int Scene::addPlanet(const vec3& center,
+                     double radius,
+                     const Material& material,
+                     gdImage* map,
+                     gdImage* ambient,
+                     gdImage* specular,
+                     double theta0,
+                     const Atmosphere* atmosphere,
+                     const Heightfield* terrain,
+                     double terrainHeight)
+{
+    PlanetRecord record;
+    record.center = center;
+    record.radius = radius;
+    record.material = addMaterial(material);
+    record.id = addHandle(PLANET, m_stagedPlanets.size());
+    record.map = map;
+    record.ambient = ambient;
+    record.specular = specular;
+    record.theta0 = theta0;
+    record.terrain = terrain;
+    record.terrainHeight = terrain != NULL ? terrainHeight : 0.0;
+    m_stagedPlanets.push_back(record);
+
+    if (atmosphere != NULL) {
+        AtmosphereShell shell;
+        shell.atmosphere = atmosphere;
+        shell.center = center;
+        shell.radius = radius;
+        m_stagedAtmospheres.push_back(shell);
+    }
+    return record.id;
+}
+
+int Scene::addPlane(const vec3& normal, const vec3& point, const Material& material)
+{
+    PlaneRecord record;
+    record.normal = normal;
+    record.point = point;
+    record.material = addMaterial(material);
+    record.id = addHandle(PLANE, m_stagedPlanes.size());
+    m_stagedPlanes.push_back(record);
+    return record.id;
+}
+
+int Scene::addTriangle(const vec3& location,
+                       const vec3& a,
+                       const vec3& b,
+                       const vec3& normal,
+                       const Material& material)
+{
+    TriangleRecord record;
+    record.location = location;
+    record.a = a;
+    record.b = b;
+    record.normal = normal;
+    record.dotaa = a.dot(a);
+    record.dotab = a.dot(b);
+    record.dotbb = b.dot(b);
+    record.invDenom = 1.0 / (record.dotaa * record.dotbb - record.dotab * record.dotab);
+    record.material = addMaterial(material);
+    record.id = addHandle(TRIANGLE, m_stagedTriangles.size());
+    m_stagedTriangles.push_back(record);
+    return record.id;
+}
+
+int Scene::addSphereSet(const SphereSet* set)
+{
+    SphereSetRecord record;
+    record.set = set;
+    record.id = addHandle(SPHERESET, m_stagedSphereSets.size());
+    m_stagedSphereSets.push_back(record);
+    return record.id;
+}
+
+int Scene::addSurface(Surface* surface)
+{
+    SurfaceRecord record;
+    record.surface = surface;
+    record.id = addHandle(SURFACE, m_stagedSurfaces.size());
+    m_stagedSurfaces.push_back(record);
+    return record.id;
+}
+
+template<class T>
+T* Scene::place(const vector<T>& staged)
+{
+    if (staged.empty()) {
+        return NULL;
+    }
+
+    T* records = m_arena.allocate<T>(staged.size());
+    for (size_t i = 0; i < staged.size(); i++) {
+        new (&records[i]) T(staged[i]);
+    }
+
+    return records;
+}
+
+void Scene::build()
+{
+    m_spheres = place(m_stagedSpheres);
+    m_planets = place(m_stagedPlanets);
+    m_planes = place(m_stagedPlanes);
+    m_triangles = place(m_stagedTriangles);
+    m_sphereSets = place(m_stagedSphereSets);
+    m_surfaces = place(m_stagedSurfaces);
+    m_materials = place(m_stagedMaterials);
+    m_handles = place(m_stagedHandles);
+
+    m_sphereCount = m_stagedSpheres.size();
+    m_planetCount = m_stagedPlanets.size();
+    m_planeCount = m_stagedPlanes.size();
+    m_triangleCount = m_stagedTriangles.size();
+    m_sphereSetCount = m_stagedSphereSets.size();
+    m_surfaceCount = m_stagedSurfaces.size();
+    m_count = m_stagedHandles.size();
+    m_atmospheres.swap(m_stagedAtmospheres);
+
+    // the arena holds the only copy from here on
+    vector<SphereRecord>().swap(m_stagedSpheres);
+    vector<PlanetRecord>().swap(m_stagedPlanets);
+    vector<PlaneRecord>().swap(m_stagedPlanes);
+    vector<TriangleRecord>().swap(m_stagedTriangles);
+    vector<SphereSetRecord>().swap(m_stagedSphereSets);
+    vector<SurfaceRecord>().swap(m_stagedSurfaces);
+    vector<Material>().swap(m_stagedMaterials);
+    vector<Handle>().swap(m_stagedHandles);
+    vector<AtmosphereShell>().swap(m_stagedAtmospheres);
+
+    buildTree();
+}
+
+void Scene::buildTree()
+{
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+
+    // the world space boxes of the bounded surfaces, in id order
+    vector<int> ids;
+    vector<vec3> lo, hi;
+    m_unbounded.clear();
+    for (int id = 0; id < m_count; id++) {
+        vec3 l, h;
+        if (bounds(id, l, h)) {
+            ids.push_back(id);
+            lo.push_back(l);
+            hi.push_back(h);
+        } else {
+            m_unbounded.push_back(id);
+        }
+    }
+
+    m_buildTime = 0.0;
+    m_refitTime = 0.0;
+    m_useTree = ids.size() >= MIN_TREE_OBJECTS;
+    if (!m_useTree) {
+        return;
+    }
+
+    // the same objects as in the last frame only need new boxes, unless
+    // they have moved so far that the old shape of the tree is poor
+    bool refit = ids == m_treeIds;
+    if (refit) {
+        m_tree.refit(lo, hi);
+        refit = m_tree.growth() <= MAX_TREE_GROWTH;
+    }
+
+    if (!refit) {
+        m_tree.build(lo, hi);
+        m_treeIds.swap(ids);
+    }
+
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    if (refit) {
+        m_refitTime = seconds;
+    } else {
+        m_buildTime = seconds;
+    }
+}
+
+bool Scene::bounds(int surface, vec3& lo, vec3& hi) const
+{
+    const Handle& handle = m_handles[surface];
+    switch (handle.type) {
+    case SPHERE:
+        sphereBounds(m_spheres[handle.index].center, m_spheres[handle.index].radius, lo, hi);
+        return true;
+    case PLANET:
+        sphereBounds(m_planets[handle.index].center,
+                     m_planets[handle.index].radius + m_planets[handle.index].terrainHeight,
+                     lo,
+                     hi);
+        return true;
+    case PLANE:
+        return false;
+    case TRIANGLE: {
+        const TriangleRecord& triangle = m_triangles[handle.index];
+        triangleBounds(triangle.location, triangle.a, triangle.b, lo, hi);
+        return true;
+    }
+    case SPHERESET:
+        return m_sphereSets[handle.index].set->bounds(lo, hi);
+    case SURFACE:
+        return m_surfaces[handle.index].surface->bounds(lo, hi);
+    }
+
+    return false;
+}
+
+bool Scene::intersect(const vec3& origin,
+                      const vec3& ray,
+                      double maxTime,
+                      Intersection& result) const
+{
+    if (!intersectGeometry(origin, ray, maxTime, result)) {
+        return false;
+    }
+
+    applyMaterial(result);
+    return true;
+}
+
+bool Scene::intersectGeometry(const vec3& origin,
+                              const vec3& ray,
+                              double maxTime,
+                              Intersection& result) const
+{
+    if (m_useTree) {
+        return intersectTree(origin, ray, maxTime, result);
+    }
+
+    // find the closest hit of each type, only computing the hit point and
+    // normal for the closest one
+    double best = maxTime;
+    Type bestType = SURFACE;
+    int bestIndex = -1;
+    int bestPart = -1;
+    double t;
+
+    for (int i = 0; i < m_sphereCount; i++) {
+        const SphereRecord& sphere = m_spheres[i];
+        if (intersectSphere(sphere.center, sphere.radius, origin, ray, best, t)
+            && t < best) {
+
+            best = t;
+            bestType = SPHERE;
+            bestIndex = i;
+        }
+    }
+
+    for (int i = 0; i < m_planetCount; i++) {
+        const PlanetRecord& planet = m_planets[i];
+        if (intersectPlanet(planet, origin, ray, best, t) && t < best) {
+
+            best = t;
+            bestType = PLANET;
+            bestIndex = i;
+        }
+    }
+
+    for (int i = 0; i < m_planeCount; i++) {
+        const PlaneRecord& plane = m_planes[i];
+        if (intersectPlane(plane.normal, plane.point, origin, ray, best, t)
+            && t < best) {
+
+            best = t;
+            bestType = PLANE;
+            bestIndex = i;
+        }
+    }
+
+    for (int i = 0; i < m_triangleCount; i++) {
+        const TriangleRecord& triangle = m_triangles[i];
+        if (intersectTriangle(triangle.location,
+                              triangle.a,
+                              triangle.b,
+                              triangle.normal,
+                              triangle.dotaa,
+                              triangle.dotab,
+                              triangle.dotbb,
+                              triangle.invDenom,
+                              origin,
+                              ray,
+                              best,
+                              t)
+            && t < best) {
+
+            best = t;
+            bestType = TRIANGLE;
+            bestIndex = i;
+        }
+    }
+
+    for (int i = 0; i < m_sphereSetCount; i++) {
+        int part;
+        if (m_sphereSets[i].set->closestSphere(origin, ray, best, t, part) && t < best) {
+            best = t;
+            bestType = SPHERESET;
+            bestIndex = i;
+            bestPart = part;
+        }
+    }
+
+    Intersection surfaceResult;
+    for (int i = 0; i < m_surfaceCount; i++) {
+        const SurfaceRecord& surface = m_surfaces[i];
+        Intersection candidate;
+        if (surface.surface->intersect(origin, ray, best, candidate)
+            && candidate.time() < best) {
+
+            best = candidate.time();
+            bestType = SURFACE;
+            bestIndex = i;
+            surfaceResult = candidate;
+        }
+    }
+
+    if (bestIndex < 0) {
+        return false;
+    }
+
+    if (bestType == SURFACE) {
+        result = surfaceResult;
+        result.surface(m_surfaces[bestIndex].id);
+        return true;
+    }
+
+    completeHit(bestType, bestIndex, bestPart, origin, ray, best, result);
+    return true;
+}
+
+void Scene::completeHit(Type type,
+                        int index,
+                        int part,
+                        const vec3& origin,
+                        const vec3& ray,
+                        double time,
+                        Intersection& result) const
+{
+    vec3 hit = origin + time * ray;
+    switch (type) {
+    case SPHERE: {
+        const SphereRecord& sphere = m_spheres[index];
+        result.normal((hit - sphere.center).normalize());
+        result.surface(sphere.id);
+        break;
+    }
+    case PLANET: {
+        const PlanetRecord& planet = m_planets[index];
+        if (planet.terrain != NULL) {
+            result.normal(planet.terrain->normal(hit - planet.center,
+                                                 planet.terrainHeight,
+                                                 planet.theta0));
+        } else {
+            result.normal((hit - planet.center).normalize());
+        }
+        result.surface(planet.id);
+        break;
+    }
+    case PLANE: {
+        const PlaneRecord& plane = m_planes[index];
+        result.normal(plane.normal);
+        result.surface(plane.id);
+        break;
+    }
+    case TRIANGLE: {
+        const TriangleRecord& triangle = m_triangles[index];
+        result.normal(triangle.normal);
+        result.surface(triangle.id);
+        break;
+    }
+    case SPHERESET: {
+        const SphereSetRecord& set = m_sphereSets[index];
+        result.normal(set.set->normal(part, hit));
+        result.surface(set.id);
+        break;
+    }
+    case SURFACE:
+        break;
+    }
+
+    result.part(part);
+    result.initialized(true);
+    result.time(time);
+    result.hit(hit);
+}
+
+bool Scene::hitSurface(int surface,
+                       const vec3& origin,
+                       const vec3& ray,
+                       double time,
+                       Intersection& result) const
+{
+    const Handle& handle = m_handles[surface];
+    if (handle.type == SURFACE) {
+        return false;
+    }
+
+    // the sphere of a set is found again along the same ray
+    int part = -1;
+    if (handle.type == SPHERESET) {
+        double t;
+        if (!m_sphereSets[handle.index].set->closestSphere(origin,
+                                                           ray,
+                                                           numeric_limits<double>::infinity(),
+                                                           t,
+                                                           part)) {
+            return false;
+        }
+    }
+
+    completeHit(handle.type, handle.index, part, origin, ray, time, result);
+    return true;
+}
+
+bool Scene::intersectClosest(int id,
+                             const vec3& origin,
+                             const vec3& ray,
+                             double& best,
+                             int& part,
+                             Intersection& surfaceResult) const
+{
+    const Handle& handle = m_handles[id];
+    if (handle.type == SURFACE) {
+        Intersection candidate;
+        if (m_surfaces[handle.index].surface->intersect(origin, ray, best, candidate)
+            && candidate.time() < best) {
+
+            best = candidate.time();
+            surfaceResult = candidate;
+            return true;
+        }
+        return false;
+    }
+
+    double t;
+    int p = -1;
+    if (intersectOne(handle, origin, ray, best, t, &p) && t < best) {
+        best = t;
+        part = p;
+        return true;
+    }
+    return false;
+}
+
+// finds the closest hit among the objects of the tree
+class Scene::ClosestVisitor {
+public:
+    ClosestVisitor(const Scene& scene, const vec3& origin, const vec3& ray)
+        : scene(scene), origin(origin), ray(ray), id(-1), part(-1) {}
+
+    bool operator()(int object, double& maxTime) {
+        int candidate = scene.m_treeIds[object];
+        if (scene.intersectClosest(candidate, origin, ray, maxTime, part, surfaceResult)) {
+            id = candidate;
+        }
+        return false;
+    }
+
+    const Scene& scene;
+    const vec3& origin;
+    const vec3& ray;
+    int id;
+    int part;
+    Intersection surfaceResult;
+};
+
+// stops at the first object of the tree that blocks the ray
+class Scene::AnyVisitor {
+public:
+    AnyVisitor(const Scene& scene, const vec3& origin, const vec3& ray, int skip)
+        : scene(scene), origin(origin), ray(ray), skip(skip), id(-1) {}
+
+    bool operator()(int object, double& maxTime) {
+        int candidate = scene.m_treeIds[object];
+        if (candidate != skip &&
+            scene.occludedOne(scene.m_handles[candidate], origin, ray, maxTime)) {
+
+            id = candidate;
+            return true;
+        }
+        return false;
+    }
+
+    const Scene& scene;
+    const vec3& origin;
+    const vec3& ray;
+    int skip;
+    int id;
+};
+
+bool Scene::intersectTree(const vec3& origin,
+                          const vec3& ray,
+                          double maxTime,
+                          Intersection& result) const
+{
+    double best = maxTime;
+    ClosestVisitor visit(*this, origin, ray);
+    m_tree.traverse(origin, ray, best, visit);
+
+    int id = visit.id;
+    for (vector<int>::const_iterator i = m_unbounded.begin(); i != m_unbounded.end(); i++) {
+        if (intersectClosest(*i, origin, ray, best, visit.part, visit.surfaceResult)) {
+            id = *i;
+        }
+    }
+
+    if (id < 0) {
+        return false;
+    }
+
+    const Handle& handle = m_handles[id];
+    if (handle.type == SURFACE) {
+        result = visit.surfaceResult;
+        result.surface(id);
+        return true;
+    }
+
+    completeHit(handle.type, handle.index, visit.part, origin, ray, best, result);
+    return true;
+}
+
+bool Scene::occludedTree(const vec3& origin,
+                         const vec3& ray,
+                         double maxTime,
+                         int skip,
+                         int& occluder) const
+{
+    double limit = maxTime;
+    AnyVisitor visit(*this, origin, ray, skip);
+    m_tree.traverse(origin, ray, limit, visit);
+    if (visit.id >= 0) {
+        occluder = visit.id;
+        return true;
+    }
+
+    for (vector<int>::const_iterator i = m_unbounded.begin(); i != m_unbounded.end(); i++) {
+        if (*i != skip && occludedOne(m_handles[*i], origin, ray, maxTime)) {
+            occluder = *i;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void Scene::applyMaterial(Intersection& result) const
+{
+    const Handle& handle = m_handles[result.surface()];
+    switch (handle.type) {
+    case SPHERE:
+        result.material(m_materials[m_spheres[handle.index].material]);
+        break;
+    case PLANET: {
+        const PlanetRecord& planet = m_planets[handle.index];
+        Material material = m_materials[planet.material];
+        mapPlanet(planetPoint(planet, result.hit()),
+                  planet.radius,
+                  planet.theta0,
+                  planet.map,
+                  planet.ambient,
+                  planet.specular,
+                  material);
+        result.material(material);
+        break;
+    }
+    case PLANE:
+        result.material(m_materials[m_planes[handle.index].material]);
+        break;
+    case TRIANGLE:
+        result.material(m_materials[m_triangles[handle.index].material]);
+        break;
+    case SPHERESET:
+        result.material(m_sphereSets[handle.index].set->material(result.part()));
+        break;
+    case SURFACE:
+        // set by the surface itself
+        break;
+    }
+}
+
+void Scene::applyMaterials(Intersection* hits, const int* indices, int count) const
+{
+    // planet hits are mapped in blocks of at most this many
+    const int block = 64;
+    double x[block], y[block], z[block];
+    int mapX[block], mapY[block];
+
+    int i = 0;
+    while (i < count) {
+        int surface = hits[indices[i]].surface();
+        const Handle& handle = m_handles[surface];
+        if (handle.type != PLANET) {
+            applyMaterial(hits[indices[i]]);
+            i++;
+            continue;
+        }
+
+        // gather the run of hits on this planet
+        const PlanetRecord& planet = m_planets[handle.index];
+        int n = 0;
+        while (i + n < count && n < block && hits[indices[i + n]].surface() == surface) {
+            vec3 pos = planetPoint(planet, hits[indices[i + n]].hit());
+            x[n] = pos.x();
+            y[n] = pos.y();
+            z[n] = pos.z();
+            n++;
+        }
+
+        sphereMapBatch(n,
+                       x,
+                       y,
+                       z,
+                       planet.radius,
+                       planet.theta0,
+                       gdImageSX(planet.map),
+                       gdImageSY(planet.map),
+                       mapX,
+                       mapY);
+
+        for (int k = 0; k < n; k++) {
+            Material material = m_materials[planet.material];
+            readPlanetMaps(mapX[k],
+                           mapY[k],
+                           planet.map,
+                           planet.ambient,
+                           planet.specular,
+                           material);
+            hits[indices[i + k]].material(material);
+        }
+
+        i += n;
+    }
+}
+
+bool Scene::intersectPlanet(const PlanetRecord& planet,
+                            const vec3& origin,
+                            const vec3& ray,
+                            double maxTime,
+                            double& time)
+{
+    if (planet.terrain == NULL) {
+        return intersectSphere(planet.center, planet.radius, origin, ray, maxTime, time);
+    }
+    return planet.terrain->intersect(origin - planet.center,
+                                     ray,
+                                     planet.radius,
+                                     planet.terrainHeight,
+                                     planet.theta0,
+                                     maxTime,
+                                     time);
+}
+
+bool Scene::occludedPlanet(const PlanetRecord& planet,
+                           const vec3& origin,
+                           const vec3& ray,
+                           double maxTime)
+{
+    if (planet.terrain == NULL) {
+        double t;
+        return intersectSphere(planet.center, planet.radius, origin, ray, maxTime, t);
+    }
+    return planet.terrain->occluded(origin - planet.center,
+                                    ray,
+                                    planet.radius,
+                                    planet.terrainHeight,
+                                    planet.theta0,
+                                    maxTime);
+}
+
+vec3 Scene::planetPoint(const PlanetRecord& planet, const vec3& hit)
+{
+    vec3 p = hit - planet.center;
+    if (planet.terrain != NULL) {
+        p *= planet.radius / p.abs();
+    }
+    return p;
+}
+
+bool Scene::intersectOne(const Handle& handle,
+                         const vec3& origin,
+                         const vec3& ray,
+                         double maxTime,
+                         double& time,
+                         int* part) const
+{
+    switch (handle.type) {
+    case SPHERE: {
+        const SphereRecord& sphere = m_spheres[handle.index];
+        return intersectSphere(sphere.center, sphere.radius, origin, ray, maxTime, time);
+    }
+    case PLANET: {
+        return intersectPlanet(m_planets[handle.index], origin, ray, maxTime, time);
+    }
+    case PLANE: {
+        const PlaneRecord& plane = m_planes[handle.index];
+        return intersectPlane(plane.normal, plane.point, origin, ray, maxTime, time);
+    }
+    case TRIANGLE: {
+        const TriangleRecord& triangle = m_triangles[handle.index];
+        return intersectTriangle(triangle.location,
+                                 triangle.a,
+                                 triangle.b,
+                                 triangle.normal,
+                                 triangle.dotaa,
+                                 triangle.dotab,
+                                 triangle.dotbb,
+                                 triangle.invDenom,
+                                 origin,
+                                 ray,
+                                 maxTime,
+                                 time);
+    }
+    case SPHERESET: {
+        int sphere;
+        if (!m_sphereSets[handle.index].set->closestSphere(origin, ray, maxTime, time, sphere)) {
+            return false;
+        }
+        if (part != NULL) {
+            *part = sphere;
+        }
+        return true;
+    }
+    case SURFACE: {
+        Intersection result;
+        if (m_surfaces[handle.index].surface->intersect(origin, ray, maxTime, result)) {
+            time = result.time();
+            return true;
+        }
+        return false;
+    }
+    }
+
+    return false;
+}
+
+bool Scene::occluded(const vec3& origin,
+                     const vec3& ray,
+                     double maxTime,
+                     int skip,
+                     int& occluder) const
+{
+    if (m_useTree) {
+        return occludedTree(origin, ray, maxTime, skip, occluder);
+    }
+
+    double t;
+
+    // a single object inbetween is enough, so stop at the first hit
+    for (int i = 0; i < m_sphereCount; i++) {
+        const SphereRecord& sphere = m_spheres[i];
+        if (sphere.id != skip &&
+            intersectSphere(sphere.center, sphere.radius, origin, ray, maxTime, t)) {
+
+            occluder = sphere.id;
+            return true;
+        }
+    }
+
+    for (int i = 0; i < m_planetCount; i++) {
+        const PlanetRecord& planet = m_planets[i];
+        if (planet.id != skip && occludedPlanet(planet, origin, ray, maxTime)) {
+
+            occluder = planet.id;
+            return true;
+        }
+    }
+
+    for (int i = 0; i < m_planeCount; i++) {
+        const PlaneRecord& plane = m_planes[i];
+        if (plane.id != skip &&
+            intersectPlane(plane.normal, plane.point, origin, ray, maxTime, t)) {
+
+            occluder = plane.id;
+            return true;
+        }
+    }
+
+    for (int i = 0; i < m_triangleCount; i++) {
+        const TriangleRecord& triangle = m_triangles[i];
+        if (triangle.id != skip &&
+            intersectTriangle(triangle.location,
+                              triangle.a,
+                              triangle.b,
+                              triangle.normal,
+                              triangle.dotaa,
+                              triangle.dotab,
+                              triangle.dotbb,
+                              triangle.invDenom,
+                              origin,
+                              ray,
+                              maxTime,
+                              t)) {
+
+            occluder = triangle.id;
+            return true;
+        }
+    }
+
+    for (int i = 0; i < m_sphereSetCount; i++) {
+        const SphereSetRecord& set = m_sphereSets[i];
+        if (set.id != skip && set.set->occluded(origin, ray, maxTime)) {
+            occluder = set.id;
+            return true;
+        }
+    }
+
+    for (int i = 0; i < m_surfaceCount; i++) {
+        const SurfaceRecord& surface = m_surfaces[i];
+        Intersection result;
+        if (surface.id != skip &&
+            surface.surface->intersect(origin, ray, maxTime, result)) {
+
+            occluder = surface.id;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+bool Scene::occludedBy(int surface,
+                       const vec3& origin,
+                       const vec3& ray,
+                       double maxTime) const
+{
+    return occludedOne(m_handles[surface], origin, ray, maxTime);
+}
+
+bool Scene::occludedOne(const Handle& handle,
+                        const vec3& origin,
+                        const vec3& ray,
+                        double maxTime) const
+{
+    if (handle.type == PLANET) {
+        return occludedPlanet(m_planets[handle.index], origin, ray, maxTime);
+    }
+    if (handle.type == SPHERESET) {
+        return m_sphereSets[handle.index].set->occluded(origin, ray, maxTime);
+    }
+
+    double t;
+    return intersectOne(handle, origin, ray, maxTime, t);
+}
+
+bool Scene::intersectSurface(int surface,
+                             const vec3& origin,
+                             const vec3& ray,
+                             double maxTime,
+                             double& time) const
+{
+    return intersectOne(m_handles[surface], origin, ray, maxTime, time);
+}
+
+bool Scene::geometryKey(unsigned long long& key) const
+{
+    if (m_surfaceCount > 0) {
+        return false;
+    }
+
+    // the shapes in id order. materials, and with them the rotation of the
+    // planets' maps, are left out, except on planets with terrain, which
+    // turns with the maps.
+    unsigned long long hash = HASH_SEED;
+    for (int id = 0; id < m_count; id++) {
+        const Handle& handle = m_handles[id];
+        hash = hashValue(hash, (double)handle.type);
+        switch (handle.type) {
+        case SPHERE:
+            hash = hashValue(hash, m_spheres[handle.index].center);
+            hash = hashValue(hash, m_spheres[handle.index].radius);
+            break;
+        case PLANET:
+            hash = hashValue(hash, m_planets[handle.index].center);
+            hash = hashValue(hash, m_planets[handle.index].radius);
+            if (m_planets[handle.index].terrain != NULL) {
+                hash = hashValue(hash, m_planets[handle.index].terrainHeight);
+                hash = hashValue(hash, m_planets[handle.index].theta0);
+            }
+            break;
+        case PLANE:
+            hash = hashValue(hash, m_planes[handle.index].normal);
+            hash = hashValue(hash, m_planes[handle.index].point);
+            break;
+        case TRIANGLE:
+            hash = hashValue(hash, m_triangles[handle.index].location);
+            hash = hashValue(hash, m_triangles[handle.index].a);
+            hash = hashValue(hash, m_triangles[handle.index].b);
+            hash = hashValue(hash, m_triangles[handle.index].normal);
+            break;
+        case SPHERESET:
+            hash = hashValue(hash, (double)m_sphereSets[handle.index].set->geometryKey());
+            break;
+        case SURFACE:
+            break;
+        }
+    }
+
+    key = hash;
+    return true;
+}
+
+bool Scene::materialKey(int surface, unsigned long long& key) const
+{
+    const Handle& handle = m_handles[surface];
+    switch (handle.type) {
+    case SPHERE:
+        key = hashMaterial(HASH_SEED, m_materials[m_spheres[handle.index].material]);
+        return true;
+    case PLANET: {
+        // the maps are told apart by where they are loaded
+        const PlanetRecord& planet = m_planets[handle.index];
+        key = hashMaterial(HASH_SEED, m_materials[planet.material]);
+        key = hashValue(key, (double)(size_t)planet.map);
+        key = hashValue(key, (double)(size_t)planet.ambient);
+        key = hashValue(key, (double)(size_t)planet.specular);
+        key = hashValue(key, planet.theta0);
+        return true;
+    }
+    case PLANE:
+        key = hashMaterial(HASH_SEED, m_materials[m_planes[handle.index].material]);
+        return true;
+    case TRIANGLE:
+        key = hashMaterial(HASH_SEED, m_materials[m_triangles[handle.index].material]);
+        return true;
+    case SPHERESET:
+        key = m_sphereSets[handle.index].set->materialKey();
+        return true;
+    case SURFACE:
+        break;
+    }
+    return false;
+}
+
+unsigned long long Scene::planetKey() const
+{
+    unsigned long long hash = HASH_SEED;
+    for (int i = 0; i < m_planetCount; i++) {
+        const PlanetRecord& planet = m_planets[i];
+        hash = hashValue(hash, (double)planet.id);
+        hash = hashValue(hash, planet.center);
+        hash = hashValue(hash, planet.radius);
+        hash = hashValue(hash, planet.theta0);
+        hash = hashValue(hash, planet.terrainHeight);
+    }
+    return hash;
+}
+
+int Scene::planetCell(int surface, const vec3& hit, int width, int height) const
+{
+    const Handle& handle = m_handles[surface];
+    if (handle.type != PLANET) {
+        return -1;
+    }
+
+    const PlanetRecord& planet = m_planets[handle.index];
+    vec3 p = planetPoint(planet, hit);
+    int x, y;
+    sphereMap(p.x(), p.y(), p.z(), planet.radius, planet.theta0, width, height, x, y);
+
+    // the mapping reaches the far edges of the map at the seam and the pole
+    x = min(width - 1, max(0, x));
+    y = min(height - 1, max(0, y));
+    return (handle.index * height + y) * width + x;
+}
+
+bool Scene::planetCellPoint(int cell, int width, int height, vec3& point, vec3& up) const
+{
+    int index = cell / (width * height);
+    if (index >= m_planetCount) {
+        return false;
+    }
+
+    // the inverse of sphereMap() at the middle of the cell
+    const PlanetRecord& planet = m_planets[index];
+    int x = cell % width,
+        y = cell / width % height;
+    double theta = (y + 0.5) * M_PI / height,
+           phi = (width / 2.0 - (x + 0.5)) * 2.0 * M_PI / width - planet.theta0;
+    vec3 direction(sin(theta) * cos(phi), cos(theta), sin(theta) * sin(phi));
+    point = planet.center + planet.radius * direction;
+    up = direction;
+    if (planet.terrain == NULL) {
+        return true;
+    }
+
+    // come down onto the terrain from above its highest ground
+    vec3 origin = point + 2.0 * planet.terrainHeight * direction;
+    double time;
+    if (intersectPlanet(planet, origin, -direction, numeric_limits<double>::infinity(), time)) {
+        point = origin - time * direction;
+    }
+    return true;
+}
+
+void Scene::release()
+{
+    m_arena.release();
+
+    m_spheres = NULL;
+    m_planets = NULL;
+    m_planes = NULL;
+    m_triangles = NULL;
+    m_sphereSets = NULL;
+    m_surfaces = NULL;
+    m_materials = NULL;
+    m_handles = NULL;
+
+    m_sphereCount = 0;
+    m_planetCount = 0;
+    m_planeCount = 0;
+    m_triangleCount = 0;
+    m_sphereSetCount = 0;
+    m_surfaceCount = 0;
+    m_count = 0;
+    m_atmospheres.clear();
+    m_useTree = false;
+}
@@ -0,0 +1,349 @@
+#ifndef __SCENE_H_
+#define __SCENE_H_
+
+#include <vector>
+#include <gd.h>
+
+#include "vec3.h"
+#include "material.h"
+#include "arena.h"
+#include "surface.h"
+#include "objecttree.h"
+#include "atmosphere.h"
+#include "heightfield.h"
+
+class SphereSet;
+
+// Storage for the surfaces of a scene. The primitive shapes are copied into
+// one contiguous array per type, allocated from an arena, and tested in
+// tight loops over each array rather than through a virtual call per
+// object. A SphereSet is packed as a reference to the set, which the scene
+// tests through its own tree and kernels. Surfaces that cannot be packed
+// are kept by pointer and tested through Surface::intersect.
+//
+// Surfaces are added through the Surface front-end with add(), after which
+// build() lays out the arrays. Every surface gets an id, in the order the
+// surfaces were added, which is reported in Intersection::surface().
+//
+// Scenes with many bounded objects also get an ObjectTree over them. A
+// scene can be released and filled again for every frame of an animation,
+// and as long as the same objects are added in the same order, build()
+// refits the tree of the last frame to the moved objects instead of
+// building a new one.
+class Scene {
+public:
+    // an atmosphere around a planet, scaled to its radius
+    struct AtmosphereShell {
+        const Atmosphere* atmosphere;
+        vec3 center;
+        double radius;
+    };
+
+    Scene();
+
+    // add a surface to the scene and return its id
+    int add(Surface& surface);
+
+    // called by the surfaces to store themselves
+    int addSphere(const vec3& center, double radius, const Material&);
+    int addPlanet(const vec3& center,
+                  double radius,
+                  const Material&,
+                  gdImage* map,
+                  gdImage* ambient,
+                  gdImage* specular,
+                  double theta0,
+                  const Atmosphere* atmosphere,
+                  const Heightfield* terrain,
+                  double terrainHeight);
+    int addPlane(const vec3& normal, const vec3& point, const Material&);
+    int addTriangle(const vec3& location,
+                    const vec3& a,
+                    const vec3& b,
+                    const vec3& normal,
+                    const Material&);
+    int addSphereSet(const SphereSet*);
+    int addSurface(Surface*);
+
+    // lay out the added surfaces in the arena. must be called before the
+    // scene is intersected, and after which no more surfaces can be added.
+    void build();
+
+    // find the closest surface along the ray
+    bool intersect(const vec3& origin,
+                   const vec3& ray,
+                   double maxTime,
+                   Intersection& result) const;
+
+    // the two halves of intersect(): find the closest surface and its hit
+    // point and normal, and then look up the material at the hit. splitting
+    // them lets callers look up the materials of many hits in one pass.
+    bool intersectGeometry(const vec3& origin,
+                           const vec3& ray,
+                           double maxTime,
+                           Intersection& result) const;
+    void applyMaterial(Intersection& result) const;
+
+    // the hit point and normal of a ray known to hit the surface with the
+    // given id at time, without searching the other surfaces. false for
+    // surfaces that are not packed, which can only be hit through
+    // intersectGeometry().
+    bool hitSurface(int surface,
+                    const vec3& origin,
+                    const vec3& ray,
+                    double time,
+                    Intersection& result) const;
+
+    // the time at which the ray hits the surface with the given id, if it
+    // does before maxTime, without searching the other surfaces
+    bool intersectSurface(int surface,
+                          const vec3& origin,
+                          const vec3& ray,
+                          double maxTime,
+                          double& time) const;
+
+    // look up the materials of the hits at the given indices. consecutive
+    // hits on the same planet are mapped to its textures in one batch.
+    void applyMaterials(Intersection* hits, const int* indices, int count) const;
+
+    // check if any surface blocks the ray before maxTime, skipping the
+    // surface with id skip, and store the id of the blocking surface
+    bool occluded(const vec3& origin,
+                  const vec3& ray,
+                  double maxTime,
+                  int skip,
+                  int& occluder) const;
+
+    // check if the surface with the given id blocks the ray before maxTime
+    bool occludedBy(int surface,
+                    const vec3& origin,
+                    const vec3& ray,
+                    double maxTime) const;
+
+    inline int size() const { return m_count; }
+
+    // the world space box of the surface with the given id, or false if it
+    // is unbounded
+    bool bounds(int surface, vec3& lo, vec3& hi) const;
+
+    // check if every surface is packed, so that the scene can tell which
+    // surface a ray hits and where from the id alone
+    inline bool packed() const { return m_surfaceCount == 0; }
+
+    // seconds spent building and refitting the object tree in the last
+    // build(); one of them is 0, or both if the scene has no tree
+    inline double buildTime() const { return m_buildTime; }
+    inline double refitTime() const { return m_refitTime; }
+
+    // number of objects in the tree, or 0 if rays test all objects in turn
+    inline int treeObjects() const { return m_useTree ? m_tree.objects() : 0; }
+
+    // a hash of the shapes and positions of the surfaces, which changes
+    // whenever a ray could hit something else. false if the scene holds
+    // surfaces that are not packed, whose shapes it cannot see.
+    bool geometryKey(unsigned long long& key) const;
+
+    // a hash of what a surface looks like where rays hit it: its material
+    // and, for planets, their maps and rotation. false for surfaces that
+    // are not packed, which pick their materials themselves.
+    bool materialKey(int surface, unsigned long long& key) const;
+
+    inline int planets() const { return m_planetCount; }
+
+    // a hash of the positions, sizes and rotations of the planets
+    unsigned long long planetKey() const;
+
+    // the cell that a hit on a planet falls in, of a grid of width x height
+    // cells laid over the maps of every planet in turn, or -1 if the
+    // surface is not a planet
+    int planetCell(int surface, const vec3& hit, int width, int height) const;
+
+    // the point on the ground of a planet in the middle of a cell of
+    // planetCell() and the direction straight up from it, or false if the
+    // cell is past the last planet
+    bool planetCellPoint(int cell, int width, int height, vec3& point, vec3& up) const;
+
+    // the atmospheres around the planets, which light passes through
+    inline const std::vector<AtmosphereShell>& atmospheres() const { return m_atmospheres; }
+
+    // free the storage of all surfaces at once. the object tree is kept to
+    // be refit by the next build().
+    void release();
+
+private:
+    enum Type { SPHERE, PLANET, PLANE, TRIANGLE, SPHERESET, SURFACE };
+
+    struct SphereRecord {
+        vec3 center;
+        double radius;
+        int material;
+        int id;
+    };
+
+    struct PlanetRecord {
+        vec3 center;
+        double radius;
+        int material;
+        int id;
+        gdImage* map;
+        gdImage* ambient;
+        gdImage* specular;
+        double theta0;
+        // the terrain over the sphere and the height of its white
+        // ground, or NULL for a smooth planet
+        const Heightfield* terrain;
+        double terrainHeight;
+    };
+
+    struct PlaneRecord {
+        vec3 normal;
+        vec3 point;
+        int material;
+        int id;
+    };
+
+    struct TriangleRecord {
+        vec3 location;
+        vec3 a;
+        vec3 b;
+        vec3 normal;
+        double dotaa;
+        double dotab;
+        double dotbb;
+        double invDenom;
+        int material;
+        int id;
+    };
+
+    struct SphereSetRecord {
+        const SphereSet* set;
+        int id;
+    };
+
+    struct SurfaceRecord {
+        Surface* surface;
+        int id;
+    };
+
+    // where the surface with a given id is stored
+    struct Handle {
+        Type type;
+        int index;
+    };
+
+    Scene(const Scene&);
+    Scene& operator=(const Scene&);
+
+    int addMaterial(const Material&);
+    int addHandle(Type type, int index);
+
+    template<class T>
+    T* place(const std::vector<T>& staged);
+
+    void completeHit(Type type,
+                     int index,
+                     int part,
+                     const vec3& origin,
+                     const vec3& ray,
+                     double time,
+                     Intersection& result) const;
+
+    // lay out the object tree over the bounded surfaces
+    void buildTree();
+
+    // test the surface with the given id for a hit before best, and lower
+    // best to it and set the part that was hit. the full hit of surfaces
+    // that are not packed is stored in surfaceResult.
+    bool intersectClosest(int id,
+                          const vec3& origin,
+                          const vec3& ray,
+                          double& best,
+                          int& part,
+                          Intersection& surfaceResult) const;
+
+    bool intersectTree(const vec3& origin,
+                       const vec3& ray,
+                       double maxTime,
+                       Intersection& result) const;
+    bool occludedTree(const vec3& origin,
+                      const vec3& ray,
+                      double maxTime,
+                      int skip,
+                      int& occluder) const;
+
+    // hit a planet, on its terrain if it has one
+    static bool intersectPlanet(const PlanetRecord& planet,
+                                const vec3& origin,
+                                const vec3& ray,
+                                double maxTime,
+                                double& time);
+    static bool occludedPlanet(const PlanetRecord& planet,
+                               const vec3& origin,
+                               const vec3& ray,
+                               double maxTime);
+
+    // a hit on a planet, relative to its center and brought down onto the
+    // sphere the maps are looked up on
+    static vec3 planetPoint(const PlanetRecord& planet, const vec3& hit);
+
+    class ClosestVisitor;
+    class AnyVisitor;
+
+    // the time of the closest hit of a surface before maxTime, and the
+    // part that was hit if part is given
+    bool intersectOne(const Handle& handle,
+                      const vec3& origin,
+                      const vec3& ray,
+                      double maxTime,
+                      double& time,
+                      int* part = NULL) const;
+
+    // check if a surface blocks the ray before maxTime, without finding
+    // the closest hit where the surface has a faster test for that
+    bool occludedOne(const Handle& handle,
+                     const vec3& origin,
+                     const vec3& ray,
+                     double maxTime) const;
+
+    Arena m_arena;
+
+    // surfaces added since the last build
+    std::vector<SphereRecord> m_stagedSpheres;
+    std::vector<PlanetRecord> m_stagedPlanets;
+    std::vector<PlaneRecord> m_stagedPlanes;
+    std::vector<TriangleRecord> m_stagedTriangles;
+    std::vector<SphereSetRecord> m_stagedSphereSets;
+    std::vector<SurfaceRecord> m_stagedSurfaces;
+    std::vector<Material> m_stagedMaterials;
+    std::vector<Handle> m_stagedHandles;
+    std::vector<AtmosphereShell> m_stagedAtmospheres;
+
+    SphereRecord* m_spheres;
+    PlanetRecord* m_planets;
+    PlaneRecord* m_planes;
+    TriangleRecord* m_triangles;
+    SphereSetRecord* m_sphereSets;
+    SurfaceRecord* m_surfaces;
+    Material* m_materials;
+    Handle* m_handles;
+
+    int m_sphereCount;
+    int m_planetCount;
+    int m_planeCount;
+    int m_triangleCount;
+    int m_sphereSetCount;
+    int m_surfaceCount;
+    int m_count;
+    std::vector<AtmosphereShell> m_atmospheres;
+
+    // the tree over the bounded surfaces, the ids of the surfaces it was
+    // built over, and the ids of the surfaces outside of it
+    ObjectTree m_tree;
+    std::vector<int> m_treeIds;
+    std::vector<int> m_unbounded;
+    bool m_useTree;
+    double m_buildTime;
+    double m_refitTime;
+};
+
+#endif // __SCENE_H_
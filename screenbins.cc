@@ -0,0 +1,249 @@
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <mutex>
+
+#include "screenbins.h"
+
+using namespace std;
+
+// tests the camera rays of one tile against the surfaces binned into it
+class ScreenBins::TileTask : public Task {
+public:
+    TileTask(const Renderer& renderer,
+             const vector<Footprint>& footprints,
+             const vector<vector<int> >& bins,
+             int x0,
+             int y0,
+             int x1,
+             int y1)
+        : m_renderer(renderer),
+          m_footprints(footprints),
+          m_bins(bins),
+          m_x0(x0),
+          m_y0(y0),
+          m_x1(x1),
+          m_y1(y1),
+          m_tests(0) {}
+
+    virtual void run(int index);
+
+    inline long long tests() const { return m_tests; }
+
+private:
+    const Renderer& m_renderer;
+    const vector<Footprint>& m_footprints;
+    const vector<vector<int> >& m_bins;
+    int m_x0;
+    int m_y0;
+    int m_x1;
+    int m_y1;
+
+    // guards the count of tests
+    mutex m_mutex;
+    long long m_tests;
+};
+
+void ScreenBins::TileTask::run(int index)
+{
+    const Scene& scene = m_renderer.scene();
+    const vec3& eye = m_renderer.camera().eye();
+    GBuffer& gbuffer = *m_renderer.gbuffer();
+    int layers = gbuffer.layers();
+
+    int tilesX = (m_x1 - m_x0 + SCREEN_BIN_SIZE - 1) / SCREEN_BIN_SIZE;
+    int x0 = m_x0 + (index % tilesX) * SCREEN_BIN_SIZE,
+        y0 = m_y0 + (index / tilesX) * SCREEN_BIN_SIZE,
+        x1 = min(x0 + SCREEN_BIN_SIZE, m_x1),
+        y1 = min(y0 + SCREEN_BIN_SIZE, m_y1);
+    int width = x1 - x0, height = y1 - y0;
+
+    // the camera rays of the tile, and the closest hit of each so far
+    vector<vec3> rays(width * height * layers);
+    vector<double> times(rays.size(), numeric_limits<double>::infinity());
+    vector<int> surfaces(rays.size(), -1);
+    for (int y = y0; y < y1; y++) {
+        for (int x = x0; x < x1; x++) {
+            for (int sample = 0; sample < layers; sample++) {
+                int i = ((y - y0) * width + (x - x0)) * layers + sample;
+                SampleStream stream = m_renderer.sampleStream(x, y, sample);
+                rays[i] = m_renderer.cameraRay(x, y, sample, stream);
+            }
+        }
+    }
+
+    // the bin is in id order, so of surfaces hit at the same time the
+    // first one added is kept
+    long long tests = 0;
+    const vector<int>& bin = m_bins[index];
+    for (vector<int>::const_iterator footprint = bin.begin();
+         footprint != bin.end();
+         footprint++) {
+
+        const Footprint& f = m_footprints[*footprint];
+        int fx0 = max(f.x0, x0), fy0 = max(f.y0, y0),
+            fx1 = min(f.x1, x1), fy1 = min(f.y1, y1);
+        for (int y = fy0; y < fy1; y++) {
+            for (int x = fx0; x < fx1; x++) {
+                int first = ((y - y0) * width + (x - x0)) * layers;
+                for (int i = first; i < first + layers; i++) {
+                    double t;
+                    if (scene.intersectSurface(f.surface, eye, rays[i], times[i], t)
+                        && t < times[i]) {
+
+                        times[i] = t;
+                        surfaces[i] = f.surface;
+                    }
+                }
+                tests += layers;
+            }
+        }
+    }
+
+    for (int y = y0; y < y1; y++) {
+        for (int x = x0; x < x1; x++) {
+            for (int sample = 0; sample < layers; sample++) {
+                int i = ((y - y0) * width + (x - x0)) * layers + sample;
+                gbuffer.store(x, y, sample, surfaces[i], times[i]);
+            }
+        }
+    }
+
+    lock_guard<mutex> lock(m_mutex);
+    m_tests += tests;
+}
+
+ScreenBins::ScreenBins(const Renderer& renderer)
+    : m_renderer(renderer),
+      m_tests(0)
+{
+}
+
+bool ScreenBins::footprint(int surface,
+                           int x0,
+                           int y0,
+                           int x1,
+                           int y1,
+                           Footprint& result) const
+{
+    result.surface = surface;
+    result.x0 = x0;
+    result.y0 = y0;
+    result.x1 = x1;
+    result.y1 = y1;
+
+    vec3 lo, hi;
+    if (!m_renderer.scene().bounds(surface, lo, hi)) {
+        return true;
+    }
+
+    // the pixel coordinates that the corners of the box project to
+    const RenderSettings& s = m_renderer.settings();
+    double pixelsPerUnit = s.imageWidth / s.screenWidth;
+    double minX = numeric_limits<double>::infinity(), maxX = -minX,
+           minY = minX, maxY = maxX;
+    for (int i = 0; i < 8; i++) {
+        vec3 corner(i & 1 ? hi.x() : lo.x(),
+                    i & 2 ? hi.y() : lo.y(),
+                    i & 4 ? hi.z() : lo.z());
+        double a, b;
+        if (!m_renderer.camera().project(corner, a, b)) {
+            return true;
+        }
+
+        double x = a * pixelsPerUnit + s.imageWidth / 2.0,
+               y = s.imageHeight / 2.0 - b * pixelsPerUnit;
+        minX = min(minX, x);
+        maxX = max(maxX, x);
+        minY = min(minY, y);
+        maxY = max(maxY, y);
+    }
+
+    // the samples of pixel x are spread over [x, x + 2) by their place on
+    // the grid and their jitter, and a pixel more is added for rounding
+    result.x0 = max((double)x0, floor(minX) - 2);
+    result.y0 = max((double)y0, floor(minY) - 2);
+    result.x1 = min((double)x1, floor(maxX) + 2);
+    result.y1 = min((double)y1, floor(maxY) + 2);
+    return result.x0 < result.x1 && result.y0 < result.y1;
+}
+
+bool ScreenBins::render(int x0, int y0, int x1, int y1, WorkerPool& pool)
+{
+    m_tests = 0;
+
+    const Scene& scene = m_renderer.scene();
+    GBuffer* gbuffer = m_renderer.gbuffer();
+    if (gbuffer == NULL || !scene.packed()) {
+        return false;
+    }
+
+    // the hits kept from the last frame are still the ones of this frame
+    if (gbuffer->reusing() || gbuffer->layers() == 0) {
+        return true;
+    }
+
+    int tilesX = (x1 - x0 + SCREEN_BIN_SIZE - 1) / SCREEN_BIN_SIZE,
+        tilesY = (y1 - y0 + SCREEN_BIN_SIZE - 1) / SCREEN_BIN_SIZE;
+
+    vector<Footprint> footprints;
+    vector<vector<int> > bins(tilesX * tilesY);
+    for (int surface = 0; surface < scene.size(); surface++) {
+        Footprint f;
+        if (!footprint(surface, x0, y0, x1, y1, f)) {
+            continue;
+        }
+
+        int tx0 = (f.x0 - x0) / SCREEN_BIN_SIZE,
+            ty0 = (f.y0 - y0) / SCREEN_BIN_SIZE,
+            tx1 = (f.x1 - 1 - x0) / SCREEN_BIN_SIZE,
+            ty1 = (f.y1 - 1 - y0) / SCREEN_BIN_SIZE;
+        for (int ty = ty0; ty <= ty1; ty++) {
+            for (int tx = tx0; tx <= tx1; tx++) {
+                bins[ty * tilesX + tx].push_back(footprints.size());
+            }
+        }
+        footprints.push_back(f);
+    }
+
+    TileTask task(m_renderer, footprints, bins, x0, y0, x1, y1);
+    pool.run(task, bins.size());
+    m_tests = task.tests();
+    return true;
+}
+
+long long ScreenBins::check(int x0, int y0, int x1, int y1) const
+{
+    const GBuffer* gbuffer = m_renderer.gbuffer();
+    if (gbuffer == NULL) {
+        return 0;
+    }
+
+    const vec3& eye = m_renderer.camera().eye();
+    long long mismatches = 0;
+    for (int y = y0; y < y1; y++) {
+        for (int x = x0; x < x1; x++) {
+            for (int sample = 0; sample < gbuffer->layers(); sample++) {
+                SampleStream stream = m_renderer.sampleStream(x, y, sample);
+                vec3 ray = m_renderer.cameraRay(x, y, sample, stream);
+
+                Intersection hit;
+                bool found = m_renderer.scene().intersectGeometry(eye,
+                                                                  ray,
+                                                                  numeric_limits<double>::infinity(),
+                                                                  hit);
+
+                int surface;
+                double time;
+                if (!gbuffer->lookup(x, y, sample, surface, time) ||
+                    found != (surface >= 0) ||
+                    (found && (surface != hit.surface() || time != hit.time()))) {
+
+                    mismatches++;
+                }
+            }
+        }
+    }
+
+    return mismatches;
+}
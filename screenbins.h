@@ -0,0 +1,66 @@
+#ifndef __SCREENBINS_H_
+#define __SCREENBINS_H_
+
+#include <vector>
+
+#include "renderer.h"
+#include "gbuffer.h"
+#include "workerpool.h"
+
+// side of the square tiles the surfaces are binned into
+#define SCREEN_BIN_SIZE 16
+
+// A pre-pass that finds the closest hits of the camera rays through bins
+// of the surfaces on the screen, instead of the tree of the scene. The box
+// of every surface is projected onto the screen, and the surface is binned
+// into the tiles its projection covers; unbounded surfaces, and ones that
+// reach behind the eye, cover the whole screen. Each tile then tests the
+// camera rays of its samples against just the surfaces of its bin, with
+// the same intersection tests the scene uses, and keeps the closest hit
+// like a depth buffer.
+//
+// This is not scan conversion: every sample still runs a full ray test
+// against each surface of its bin, so the pass costs about as much as
+// tracing the camera rays. What it gives is the g-buffer of the renderer
+// filled tile by tile for the samples it holds, with the hits the traced
+// rays find, which the integrators then start from; reflection and shadow
+// rays are still traced. Since the projected boxes are widened to cover
+// the jitter of the samples and rounding, the hits are exactly the traced
+// ones, which check() confirms by tracing them.
+class ScreenBins {
+public:
+    ScreenBins(const Renderer& renderer);
+
+    // fill the g-buffer of the renderer with the hits of the pixels in
+    // [x0, x1) x [y0, y1). false if the scene has surfaces that can not be
+    // binned, or there is no g-buffer to fill.
+    bool render(int x0, int y0, int x1, int y1, WorkerPool& pool);
+
+    // trace the camera rays of the samples held in the g-buffer over the
+    // pixels in [x0, x1) x [y0, y1), and return the number of them whose
+    // hit differs from the stored one
+    long long check(int x0, int y0, int x1, int y1) const;
+
+    // number of ray and surface tests of the last render()
+    inline long long tests() const { return m_tests; }
+
+private:
+    class TileTask;
+
+    // a surface binned into the tiles, and the pixels it may cover
+    struct Footprint {
+        int surface;
+        int x0;
+        int y0;
+        int x1;
+        int y1;
+    };
+
+    // the pixels whose samples may see the surface, clipped to the window
+    bool footprint(int surface, int x0, int y0, int x1, int y1, Footprint& result) const;
+
+    const Renderer& m_renderer;
+    long long m_tests;
+};
+
+#endif // __SCREENBINS_H_
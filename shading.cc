@@ -0,0 +1,118 @@
+#include <cmath>
+#include <algorithm>
+
+#include "shading.h"
+
+using namespace std;
+
+typedef void (*LightKernel)(const LightShading* lights, int count);
+
+// x to the power of Exponent by repeated squaring, or of shininess with
+// pow() when Exponent is 0
+template<int Exponent>
+struct Power {
+    static inline double of(double x, double shininess) {
+        double half = Power<Exponent / 2>::of(x, shininess);
+        return Exponent % 2 ? half * half * x : half * half;
+    }
+};
+
+template<>
+struct Power<1> {
+    static inline double of(double x, double /*shininess*/) { return x; }
+};
+
+template<>
+struct Power<0> {
+    static inline double of(double x, double shininess) { return pow(x, shininess); }
+};
+
+// the terms of shadeLight() for a material with the given terms. the
+// tests of the weights are resolved at compile time, and the specular
+// term is selected rather than branched on, so the loop runs straight
+// through a batch.
+template<bool Diffuse, bool Specular, int Exponent>
+static void shadeLightsWith(const LightShading* lights, int count)
+{
+    for (int i = 0; i < count; i++) {
+        const LightShading& light = lights[i];
+        const LightSample& sample = *light.sample;
+        const Material& material = light.hit->material();
+        const vec3& throughput = *light.throughput;
+        const Color& lightColor = sample.color;
+
+        if (Diffuse) {
+            *light.radiance += sample.weight
+                             * material.diffuseWeight()
+                             * sample.nDotl
+                             * throughput.mul(lightColor.mul(material.diffuseColor()));
+        }
+
+        if (Specular) {
+            vec3 r = 2.0 * sample.nDotl * light.hit->normal() - sample.direction;
+            double rDotMd = -r.dot(*light.ray);
+            double highlight = rDotMd > 0
+                             ? Power<Exponent>::of(max(rDotMd, 0.0), material.shininess())
+                             : 0.0;
+            *light.radiance += sample.weight
+                             * highlight
+                             * material.specularWeight()
+                             * sample.nDotl
+                             * throughput.mul(lightColor.mul(material.highlightColor()));
+        }
+    }
+}
+
+// fills in the kernels of every exponent up to Exponent
+template<int Exponent>
+struct LightKernels {
+    static void fill(LightKernel* kernels) {
+        kernels[4 * Exponent + 0] = &shadeLightsWith<false, false, Exponent>;
+        kernels[4 * Exponent + 1] = &shadeLightsWith<true, false, Exponent>;
+        kernels[4 * Exponent + 2] = &shadeLightsWith<false, true, Exponent>;
+        kernels[4 * Exponent + 3] = &shadeLightsWith<true, true, Exponent>;
+        LightKernels<Exponent - 1>::fill(kernels);
+    }
+};
+
+template<>
+struct LightKernels<-1> {
+    static void fill(LightKernel* /*kernels*/) {}
+};
+
+class LightKernelTable {
+public:
+    LightKernelTable() { LightKernels<MAX_INTEGER_SHININESS>::fill(m_kernels); }
+
+    inline LightKernel operator[](int kernel) const { return m_kernels[kernel]; }
+
+private:
+    LightKernel m_kernels[SHADING_KERNELS];
+};
+
+static const LightKernelTable kernels;
+
+int shadingKernel(const Material& material)
+{
+    bool diffuse = material.diffuseWeight() > 0;
+    bool specular = material.specularWeight() > 0;
+
+    // integer shininess takes the kernel with its power unrolled, and any
+    // other the one that calls pow()
+    int exponent = 0;
+    double shininess = material.shininess();
+    if (specular &&
+        shininess >= 1 &&
+        shininess <= MAX_INTEGER_SHININESS &&
+        shininess == floor(shininess)) {
+
+        exponent = shininess;
+    }
+
+    return 4 * exponent + (specular ? 2 : 0) + (diffuse ? 1 : 0);
+}
+
+void shadeLights(int kernel, const LightShading* lights, int count)
+{
+    kernels[kernel](lights, count);
+}
@@ -0,0 +1,47 @@
+#ifndef __SHADING_H_
+#define __SHADING_H_
+
+#include "vec3.h"
+#include "color.h"
+#include "material.h"
+#include "surface.h"
+
+// highest shininess that is raised to by multiplications rather than pow()
+#define MAX_INTEGER_SHININESS 16
+
+// number of distinct shading kernels
+#define SHADING_KERNELS (4 * (MAX_INTEGER_SHININESS + 1))
+
+// A light picked for a shading point, and the shadow ray towards it
+struct LightSample {
+    int light;
+    double weight;
+    vec3 direction;
+    double distance;
+    double nDotl;
+    // the color of the light as it reaches the shading point
+    Color color;
+};
+
+// A visible light sample of a hit, to be added to the radiance of the path
+// that found the hit
+struct LightShading {
+    const vec3* ray;
+    const vec3* throughput;
+    const Intersection* hit;
+    const LightSample* sample;
+    Color* radiance;
+};
+
+// The kernel that shades lights for a material. Each kernel is compiled for
+// one combination of the diffuse and specular terms, and for shininess that
+// is a small integer, the power that raises to it. Materials only change
+// kernel when their weights or shininess do, so the presets of material.h
+// each keep to a single kernel.
+int shadingKernel(const Material& material);
+
+// add the diffuse and specular terms of count visible lights, whose hits
+// all have materials of the given kernel
+void shadeLights(int kernel, const LightShading* lights, int count);
+
+#endif // __SHADING_H_
@@ -0,0 +1,8 @@
+#include "shadowcache.h"
+
+ShadowCache::ShadowCache(int lights)
+    : m_occluders(lights, -1),
+      m_lookups(0),
+      m_hits(0)
+{
+}
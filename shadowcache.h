@@ -0,0 +1,30 @@
+#ifndef __SHADOWCACHE_H_
+#define __SHADOWCACHE_H_
+
+#include <vector>
+
+// Remembers the surface that last blocked a shadow ray towards each light.
+// Neighbouring shading points are usually shadowed by the same surface, so
+// testing that surface first lets most shadow rays skip the full scan. The
+// cache is not synchronized; every render worker keeps its own.
+class ShadowCache {
+public:
+    ShadowCache(int lights);
+
+    // id of the last occluder of a light, or -1 if there is none
+    inline int occluder(int light) const { return m_occluders[light]; }
+    inline void occluder(int light, int surface) { m_occluders[light] = surface; }
+
+    // record the outcome of testing a cached occluder
+    inline void lookup(bool hit) { m_lookups++; if (hit) { m_hits++; } }
+
+    inline long long lookups() const { return m_lookups; }
+    inline long long hits() const { return m_hits; }
+
+private:
+    std::vector<int> m_occluders;
+    long long m_lookups;
+    long long m_hits;
+};
+
+#endif // __SHADOWCACHE_H_
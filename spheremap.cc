@@ -0,0 +1,281 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <vector>
+
+#include "spheremap.h"
+
+using namespace std;
+
+static bool s_exact = false;
+
+void exactSphereMap(bool exact)
+{
+    s_exact = exact;
+}
+
+bool exactSphereMap()
+{
+    return s_exact;
+}
+
+// atan of t for |t| <= tan(pi/8), through its taylor series. the series
+// alternates, so the error is below the first omitted term, which is
+// tan(pi/8)^23 / 23 < 2e-10.
+static inline double atanKernel(double t)
+{
+    double s = t * t;
+    double p = 1.0/21.0;
+    p = p * s - 1.0/19.0;
+    p = p * s + 1.0/17.0;
+    p = p * s - 1.0/15.0;
+    p = p * s + 1.0/13.0;
+    p = p * s - 1.0/11.0;
+    p = p * s + 1.0/9.0;
+    p = p * s - 1.0/7.0;
+    p = p * s + 1.0/5.0;
+    p = p * s - 1.0/3.0;
+    p = p * s + 1.0;
+    return t * p;
+}
+
+// atan2 reduced to atanKernel. written with selects only, so that a loop
+// over it vectorizes.
+static inline double atan2Kernel(double y, double x)
+{
+    double ax = fabs(x), ay = fabs(y);
+    double big = ax > ay ? ax : ay;
+    double small = ax > ay ? ay : ax;
+    double a = small / (big > 0.0 ? big : 1.0);
+
+    // atan(a) = pi/4 + atan((a - 1) / (a + 1)) moves a into the range of
+    // the kernel. both sides are computed, so that the choice is a select.
+    bool shift = a > 0.41421356237309503;
+    double shifted = (a - 1.0) / (a + 1.0);
+    double r = atanKernel(shift ? shifted : a) + (shift ? M_PI / 4.0 : 0.0);
+
+    double swapped = M_PI / 2.0 - r;
+    r = ay > ax ? swapped : r;
+    double mirrored = M_PI - r;
+    r = x < 0.0 ? mirrored : r;
+    return copysign(r, y);
+}
+
+static inline double acosKernel(double x)
+{
+    x = x > 1.0 ? 1.0 : x;
+    x = x < -1.0 ? -1.0 : x;
+    return atan2Kernel(sqrt((1.0 - x) * (1.0 + x)), x);
+}
+
+double acosApprox(double x)
+{
+    return acosKernel(x);
+}
+
+double atan2Approx(double y, double x)
+{
+    return atan2Kernel(y, x);
+}
+
+void sphereMapExact(double x,
+                    double y,
+                    double z,
+                    double radius,
+                    double theta0,
+                    int width,
+                    int height,
+                    int& mapX,
+                    int& mapY)
+{
+    double theta = acos(y / radius);
+    double phi = atan2(z, x);
+
+    phi = phi + theta0;
+    if (phi > M_PI) {
+        phi = phi - 2*M_PI;
+    }
+    else if (phi < -M_PI) {
+        phi = phi + 2*M_PI;
+    }
+
+    mapX = (int)(width/2.0 - phi*width/(2.0*M_PI));
+    mapY = (int)(theta*height/(M_PI));
+}
+
+// the polynomial mapping of one point. sphereMap() and the lanes of
+// sphereMapBatch() both go through it, so that a hit maps to the same texel
+// in either.
+static inline void sphereMapPoint(double x,
+                                  double y,
+                                  double z,
+                                  double inverseRadius,
+                                  double theta0,
+                                  int width,
+                                  int height,
+                                  int& mapX,
+                                  int& mapY)
+{
+    double theta = acosKernel(y * inverseRadius);
+    double phi = atan2Kernel(z, x) + theta0;
+    double wrapped = phi > M_PI ? phi - 2*M_PI : phi + 2*M_PI;
+    phi = (phi > M_PI || phi < -M_PI) ? wrapped : phi;
+
+    mapX = (int)(width/2.0 - phi*width/(2.0*M_PI));
+    mapY = (int)(theta*height/(M_PI));
+}
+
+// the polynomial mapping of SPHEREMAP_LANES points. the fixed trip count
+// lets the loop be vectorized without a scalar remainder.
+static void sphereMapLanes(const double* x,
+                           const double* y,
+                           const double* z,
+                           double inverseRadius,
+                           double theta0,
+                           int width,
+                           int height,
+                           int* mapX,
+                           int* mapY)
+{
+    for (int i = 0; i < SPHEREMAP_LANES; i++) {
+        sphereMapPoint(x[i], y[i], z[i], inverseRadius, theta0, width, height, mapX[i], mapY[i]);
+    }
+}
+
+void sphereMap(double x,
+               double y,
+               double z,
+               double radius,
+               double theta0,
+               int width,
+               int height,
+               int& mapX,
+               int& mapY)
+{
+    if (s_exact) {
+        sphereMapExact(x, y, z, radius, theta0, width, height, mapX, mapY);
+        return;
+    }
+
+    sphereMapPoint(x, y, z, 1.0 / radius, theta0, width, height, mapX, mapY);
+}
+
+void sphereMapBatch(int count,
+                    const double* x,
+                    const double* y,
+                    const double* z,
+                    double radius,
+                    double theta0,
+                    int width,
+                    int height,
+                    int* mapX,
+                    int* mapY)
+{
+    if (s_exact) {
+        for (int i = 0; i < count; i++) {
+            sphereMapExact(x[i], y[i], z[i], radius, theta0, width, height, mapX[i], mapY[i]);
+        }
+        return;
+    }
+
+    double inverseRadius = 1.0 / radius;
+    int full = count - count % SPHEREMAP_LANES;
+    for (int i = 0; i < full; i += SPHEREMAP_LANES) {
+        sphereMapLanes(x + i, y + i, z + i,
+                       inverseRadius, theta0, width, height,
+                       mapX + i, mapY + i);
+    }
+
+    // pad the last block rather than falling back to a scalar loop
+    if (full < count) {
+        double px[SPHEREMAP_LANES], py[SPHEREMAP_LANES], pz[SPHEREMAP_LANES];
+        int pmapX[SPHEREMAP_LANES], pmapY[SPHEREMAP_LANES];
+        for (int i = 0; i < SPHEREMAP_LANES; i++) {
+            int j = full + i < count ? full + i : full;
+            px[i] = x[j];
+            py[i] = y[j];
+            pz[i] = z[j];
+        }
+
+        sphereMapLanes(px, py, pz,
+                       inverseRadius, theta0, width, height,
+                       pmapX, pmapY);
+
+        for (int i = 0; full + i < count; i++) {
+            mapX[full + i] = pmapX[i];
+            mapY[full + i] = pmapY[i];
+        }
+    }
+}
+
+bool checkSphereMap(int count)
+{
+    // the angles on an even sweep of their whole domains, which takes in
+    // the ends and the seams where the reductions switch branches, and the
+    // axes at a few scales
+    double maxAcos = 0.0, maxAtan2 = 0.0;
+    for (int i = 0; i <= count; i++) {
+        double x = -1.0 + 2.0 * i / count;
+        maxAcos = max(maxAcos, fabs(acosApprox(x) - acos(x)));
+
+        double angle = -M_PI + 2.0 * M_PI * i / count;
+        for (double scale = 1e-3; scale <= 1e3; scale *= 1e3) {
+            double c = scale * cos(angle), s = scale * sin(angle);
+            maxAtan2 = max(maxAtan2, fabs(atan2Approx(s, c) - atan2(s, c)));
+        }
+    }
+    const double axes[][2] = {{0.0, 1.0}, {0.0, -1.0}, {1.0, 0.0}, {-1.0, 0.0},
+                              {-0.0, -1.0}, {0.0, 0.0}};
+    for (size_t i = 0; i < sizeof(axes) / sizeof(axes[0]); i++) {
+        double y = axes[i][0], x = axes[i][1];
+        maxAtan2 = max(maxAtan2, fabs(atan2Approx(y, x) - atan2(y, x)));
+    }
+
+    // random points on a sphere, with some of the points on the axes and
+    // seams, mapped one at a time and as a batch
+    int width = 10800, height = 5400;
+    vector<double> x(count), y(count), z(count);
+    srand(1);
+    for (int i = 0; i < count; i++) {
+        x[i] = 2.0 * rand() / RAND_MAX - 1.0;
+        y[i] = 2.0 * rand() / RAND_MAX - 1.0;
+        z[i] = 2.0 * rand() / RAND_MAX - 1.0;
+        switch (i % 16) {
+        case 0: x[i] = 0.0; break;
+        case 1: z[i] = 0.0; break;
+        case 2: z[i] = x[i]; break;
+        case 3: z[i] = -x[i]; break;
+        }
+    }
+
+    double radius = 1.5;
+    vector<int> batchX(count), batchY(count);
+    if (count > 0) {
+        sphereMapBatch(count, &x[0], &y[0], &z[0], radius, 0.5, width, height,
+                       &batchX[0], &batchY[0]);
+    }
+
+    int texelErrors = 0, batchErrors = 0;
+    for (int i = 0; i < count; i++) {
+        int exactX, exactY, mapX, mapY;
+        sphereMapExact(x[i], y[i], z[i], radius, 0.5, width, height, exactX, exactY);
+        sphereMap(x[i], y[i], z[i], radius, 0.5, width, height, mapX, mapY);
+        if (exactX != mapX || exactY != mapY) {
+            texelErrors++;
+        }
+        if (batchX[i] != mapX || batchY[i] != mapY) {
+            batchErrors++;
+        }
+    }
+
+    cout << "sphere map: max acos error " << maxAcos
+         << ", max atan2 error " << maxAtan2
+         << ", " << texelErrors << " of " << count
+         << " texels differ from libm, " << batchErrors
+         << " differ between single points and batches" << endl;
+
+    return maxAcos <= SPHEREMAP_MAX_ERROR
+        && maxAtan2 <= SPHEREMAP_MAX_ERROR
+        && batchErrors == 0;
+}
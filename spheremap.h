@@ -0,0 +1,71 @@
+#ifndef __SPHEREMAP_H_
+#define __SPHEREMAP_H_
+
+// Mapping of points on a sphere to the pixels of an equirectangular map,
+// as used for the textures of planets. A point (x, y, z) relative to the
+// center has the polar angle acos(y / radius) and the azimuth atan2(z, x),
+// which is turned by theta0 before it is scaled to the map.
+//
+// Besides the exact version using libm, there is a polynomial version that
+// computes both angles through a single atan kernel, without branches, and
+// in blocks of SPHEREMAP_LANES points so that the compiler can vectorize
+// it. Its angles are within SPHEREMAP_MAX_ERROR radians of libm, a small
+// fraction of a pixel for any map we use.
+
+// points handled together by the batched version
+#define SPHEREMAP_LANES 8
+
+// bound on the error of the polynomial angles, in radians
+#define SPHEREMAP_MAX_ERROR 1e-8
+
+// choose between the exact and the polynomial mapping for sphereMap()
+void exactSphereMap(bool exact);
+bool exactSphereMap();
+
+// map a single point, using the version chosen above
+void sphereMap(double x,
+               double y,
+               double z,
+               double radius,
+               double theta0,
+               int width,
+               int height,
+               int& mapX,
+               int& mapY);
+
+// map a single point with libm
+void sphereMapExact(double x,
+                    double y,
+                    double z,
+                    double radius,
+                    double theta0,
+                    int width,
+                    int height,
+                    int& mapX,
+                    int& mapY);
+
+// map count points on the same sphere, using the version chosen above.
+// the polynomial version runs SPHEREMAP_LANES points at a time.
+void sphereMapBatch(int count,
+                    const double* x,
+                    const double* y,
+                    const double* z,
+                    double radius,
+                    double theta0,
+                    int width,
+                    int height,
+                    int* mapX,
+                    int* mapY);
+
+// the polynomial angles, for a single value
+double acosApprox(double x);
+double atan2Approx(double y, double x);
+
+// compare the polynomial angles against libm on count steps across their
+// domains, and the map coordinates on count random points, one at a time
+// against libm and against batches. prints the errors, and returns whether
+// the angles are within SPHEREMAP_MAX_ERROR and the batches map every
+// point to the same texel as single points. run by make check.
+bool checkSphereMap(int count);
+
+#endif // __SPHEREMAP_H_
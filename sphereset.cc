@@ -0,0 +1,320 @@
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <limits>
+
+#include "raytracer.h"
+#include "hash.h"
+#include "scene.h"
+#include "sphereset.h"
+
+using namespace std;
+
+// the intersection test of intersectSphere() for a group of spheres at
+// once, storing the time of the hit with every sphere, or infinity for a
+// miss. the coordinates are widened to doubles so the times agree with the
+// ones of Sphere. both roots are computed and then selected, and the fixed
+// trip count lets the loop be vectorized without a scalar remainder.
+static void intersectLanes(const float* __restrict x,
+                           const float* __restrict y,
+                           const float* __restrict z,
+                           const float* __restrict radius,
+                           const vec3& origin,
+                           const vec3& ray,
+                           double maxTime,
+                           double* __restrict times)
+{
+    const double inf = numeric_limits<double>::infinity();
+    double ox = origin.x(), oy = origin.y(), oz = origin.z();
+    double dx = ray.x(), dy = ray.y(), dz = ray.z();
+
+    for (int j = 0; j < SPHERESET_LANES; j++) {
+        double lx = ox - x[j], ly = oy - y[j], lz = oz - z[j];
+        double r = radius[j];
+        double B = 2.0 * (dx*lx + dy*ly + dz*lz);
+        double C = (lx*lx + ly*ly + lz*lz) - r * r;
+        double square = B * B - 4 * C;
+
+        double root = sqrt(square >= 0 ? square : 0.0);
+        double t1 = 0.5 * (-B - root);
+        double t2 = 0.5 * (-B + root);
+        double t = t1 >= EPSILON && t1 <= maxTime
+                 ? t1
+                 : (t2 >= EPSILON && t2 < maxTime ? t2 : inf);
+
+        // padding lanes have NaN centers, which fail the comparison too
+        times[j] = square >= 0 ? t : inf;
+    }
+}
+
+// spread the low 10 bits of v so that there are two zero bits between each
+static unsigned int spreadBits(unsigned int v)
+{
+    v &= 0x3FF;
+    v = (v | (v << 16)) & 0x030000FF;
+    v = (v | (v << 8)) & 0x0300F00F;
+    v = (v | (v << 4)) & 0x030C30C3;
+    v = (v | (v << 2)) & 0x09249249;
+    return v;
+}
+
+// orders sphere indices by their position on a morton curve
+class SphereCurveOrder {
+public:
+    SphereCurveOrder(const vector<unsigned int>& codes) : m_codes(codes) {}
+
+    bool operator()(int a, int b) const { return m_codes[a] < m_codes[b]; }
+
+private:
+    const vector<unsigned int>& m_codes;
+};
+
+// walks the groups of the tree and keeps the closest hit
+class SphereSet::GroupVisitor {
+public:
+    GroupVisitor(const SphereSet& set, const vec3& origin, const vec3& ray)
+        : set(set), origin(origin), ray(ray), sphere(-1), time(0.0) {}
+
+    bool operator()(int group, double& maxTime) {
+        double t;
+        int hit = set.intersectGroup(group, origin, ray, maxTime, t);
+        if (hit >= 0) {
+            sphere = hit;
+            time = t;
+            maxTime = t;
+        }
+        return false;
+    }
+
+    const SphereSet& set;
+    const vec3& origin;
+    const vec3& ray;
+    int sphere;
+    double time;
+};
+
+// walks the groups of the tree until one of them blocks the ray
+class SphereSet::AnyGroupVisitor {
+public:
+    AnyGroupVisitor(const SphereSet& set, const vec3& origin, const vec3& ray)
+        : set(set), origin(origin), ray(ray), blocked(false) {}
+
+    bool operator()(int group, double& maxTime) {
+        double t;
+        blocked = set.intersectGroup(group, origin, ray, maxTime, t) >= 0;
+        return blocked;
+    }
+
+    const SphereSet& set;
+    const vec3& origin;
+    const vec3& ray;
+    bool blocked;
+};
+
+SphereSet::SphereSet()
+    : m_count(0)
+{
+}
+
+int SphereSet::addMaterial(const Material& material)
+{
+    assert(m_materials.size() < SPHERESET_MAX_MATERIALS);
+    m_materials.push_back(material);
+    return m_materials.size() - 1;
+}
+
+void SphereSet::add(const vec3& center, double radius, int material)
+{
+    assert(material >= 0 && material < (int)m_materials.size());
+    m_x.push_back(center.x());
+    m_y.push_back(center.y());
+    m_z.push_back(center.z());
+    m_radius.push_back(radius);
+    m_material.push_back(material);
+    m_count++;
+}
+
+void SphereSet::build()
+{
+    if (m_count == 0) {
+        m_tree.build(vector<vec3>(), vector<vec3>());
+        return;
+    }
+
+    m_lo = vec3(m_x[0], m_y[0], m_z[0]);
+    m_hi = m_lo;
+    for (int i = 0; i < m_count; i++) {
+        double r = m_radius[i];
+        m_lo = vec3(min(m_lo.x(), m_x[i] - r), min(m_lo.y(), m_y[i] - r), min(m_lo.z(), m_z[i] - r));
+        m_hi = vec3(max(m_hi.x(), m_x[i] + r), max(m_hi.y(), m_y[i] + r), max(m_hi.z(), m_z[i] + r));
+    }
+
+    // sort the spheres along a morton curve through the bounds, so that
+    // the spheres of a group are close together
+    vec3 extent = m_hi - m_lo;
+    double scale = 1023.0 / max(EPSILON, max(extent.x(), max(extent.y(), extent.z())));
+    vector<unsigned int> codes(m_count);
+    vector<int> order(m_count);
+    for (int i = 0; i < m_count; i++) {
+        unsigned int x = (m_x[i] - m_lo.x()) * scale,
+                     y = (m_y[i] - m_lo.y()) * scale,
+                     z = (m_z[i] - m_lo.z()) * scale;
+        codes[i] = spreadBits(x) | (spreadBits(y) << 1) | (spreadBits(z) << 2);
+        order[i] = i;
+    }
+    sort(order.begin(), order.end(), SphereCurveOrder(codes));
+
+    int groups = (m_count + SPHERESET_LANES - 1) / SPHERESET_LANES;
+    int padded = groups * SPHERESET_LANES;
+    const float nan = numeric_limits<float>::quiet_NaN();
+    vector<float> x(padded, nan), y(padded, nan), z(padded, nan), radius(padded, 0.0f);
+    vector<unsigned short> material(padded, 0);
+    for (int i = 0; i < m_count; i++) {
+        x[i] = m_x[order[i]];
+        y[i] = m_y[order[i]];
+        z[i] = m_z[order[i]];
+        radius[i] = m_radius[order[i]];
+        material[i] = m_material[order[i]];
+    }
+    m_x.swap(x);
+    m_y.swap(y);
+    m_z.swap(z);
+    m_radius.swap(radius);
+    m_material.swap(material);
+
+    // the boxes of the groups, leaving out the padding
+    vector<vec3> lo(groups), hi(groups);
+    for (int g = 0; g < groups; g++) {
+        int first = g * SPHERESET_LANES, last = min(m_count, first + SPHERESET_LANES);
+        for (int i = first; i < last; i++) {
+            double r = m_radius[i];
+            vec3 l(m_x[i] - r, m_y[i] - r, m_z[i] - r), h(m_x[i] + r, m_y[i] + r, m_z[i] + r);
+            lo[g] = i == first ? l : vec3(min(lo[g].x(), l.x()), min(lo[g].y(), l.y()), min(lo[g].z(), l.z()));
+            hi[g] = i == first ? h : vec3(max(hi[g].x(), h.x()), max(hi[g].y(), h.y()), max(hi[g].z(), h.z()));
+        }
+    }
+
+    m_tree.build(lo, hi);
+}
+
+int SphereSet::intersectGroup(int group,
+                              const vec3& origin,
+                              const vec3& ray,
+                              double maxTime,
+                              double& time) const
+{
+    int first = group * SPHERESET_LANES;
+    double times[SPHERESET_LANES];
+    intersectLanes(&m_x[first],
+                   &m_y[first],
+                   &m_z[first],
+                   &m_radius[first],
+                   origin,
+                   ray,
+                   maxTime,
+                   times);
+
+    int hit = -1;
+    time = maxTime;
+    for (int j = 0; j < SPHERESET_LANES; j++) {
+        if (times[j] < time) {
+            time = times[j];
+            hit = first + j;
+        }
+    }
+
+    return hit;
+}
+
+bool SphereSet::closestSphere(const vec3& origin,
+                              const vec3& ray,
+                              double maxTime,
+                              double& time,
+                              int& sphere) const
+{
+    double best = maxTime;
+    GroupVisitor visit(*this, origin, ray);
+    m_tree.traverse(origin, ray, best, visit);
+    if (visit.sphere < 0) {
+        return false;
+    }
+
+    time = visit.time;
+    sphere = visit.sphere;
+    return true;
+}
+
+bool SphereSet::occluded(const vec3& origin, const vec3& ray, double maxTime) const
+{
+    double limit = maxTime;
+    AnyGroupVisitor visit(*this, origin, ray);
+    m_tree.traverse(origin, ray, limit, visit);
+    return visit.blocked;
+}
+
+vec3 SphereSet::normal(int sphere, const vec3& hit) const
+{
+    vec3 center(m_x[sphere], m_y[sphere], m_z[sphere]);
+    return (hit - center).normalize();
+}
+
+unsigned long long SphereSet::geometryKey() const
+{
+    unsigned long long hash = hashValue(HASH_SEED, (double)m_count);
+    for (int i = 0; i < m_count; i++) {
+        hash = hashValue(hash, vec3(m_x[i], m_y[i], m_z[i]));
+        hash = hashValue(hash, (double)m_radius[i]);
+    }
+    return hash;
+}
+
+unsigned long long SphereSet::materialKey() const
+{
+    unsigned long long hash = hashValue(HASH_SEED, (double)m_materials.size());
+    for (vector<Material>::const_iterator material = m_materials.begin();
+         material != m_materials.end();
+         material++) {
+
+        hash = hashMaterial(hash, *material);
+    }
+    for (int i = 0; i < m_count; i++) {
+        hash = hashValue(hash, (double)m_material[i]);
+    }
+    return hash;
+}
+
+bool SphereSet::intersect(const vec3& origin,
+                          const vec3& ray,
+                          double maxTime,
+                          Intersection& result)
+{
+    double time;
+    int sphere;
+    if (!closestSphere(origin, ray, maxTime, time, sphere)) {
+        return false;
+    }
+
+    result.initialized(true);
+    result.time(time);
+    result.hit(origin + time * ray);
+    result.normal(normal(sphere, result.hit()));
+    result.material(material(sphere));
+    result.part(sphere);
+    return true;
+}
+
+int SphereSet::pack(Scene& scene)
+{
+    return scene.addSphereSet(this);
+}
+
+bool SphereSet::bounds(vec3& lo, vec3& hi) const
+{
+    if (m_count == 0) {
+        return false;
+    }
+
+    lo = m_lo;
+    hi = m_hi;
+    return true;
+}
@@ -0,0 +1,97 @@
+#ifndef __SPHERESET_H_
+#define __SPHERESET_H_
+
+#include <vector>
+
+#include "vec3.h"
+#include "material.h"
+#include "surface.h"
+#include "objecttree.h"
+
+// spheres tested together by the intersection kernel of a SphereSet
+#define SPHERESET_LANES 8
+
+// materials a SphereSet can tell apart in its 16 bit indices
+#define SPHERESET_MAX_MATERIALS 65536
+
+// A large number of spheres sharing a small set of materials, such as the
+// rocks of an asteroid belt. The centers and radii are kept as floats in
+// one array per coordinate, with a material index per sphere, so a sphere
+// takes 18 bytes rather than a Sphere object with its own Material.
+//
+// The spheres are sorted along a space filling curve and cut into groups
+// of SPHERESET_LANES neighbours, and an ObjectTree over the boxes of the
+// groups finds the groups a ray passes through. Each group is tested by a
+// kernel over all of its spheres at once, written to be vectorized. To the
+// scene the whole set is a single packed surface, and a single object of
+// its object tree, and hits report the sphere in Intersection::part(). The
+// scene refers to the set, which must outlive it.
+class SphereSet : public Surface {
+public:
+    SphereSet();
+
+    // add a material for the spheres to refer to, and return its index.
+    // there can be at most SPHERESET_MAX_MATERIALS.
+    int addMaterial(const Material& material);
+
+    // add a sphere with a material returned by addMaterial()
+    void add(const vec3& center, double radius, int material);
+
+    // sort the spheres into groups and build the tree over them. must be
+    // called before the set is traced, after which no more spheres can be
+    // added.
+    void build();
+
+    inline int size() const { return m_count; }
+
+    // the closest sphere hit before maxTime, and the time of the hit
+    bool closestSphere(const vec3& origin,
+                       const vec3& ray,
+                       double maxTime,
+                       double& time,
+                       int& sphere) const;
+
+    // check if any sphere blocks the ray before maxTime, stopping at the
+    // first group that does
+    bool occluded(const vec3& origin, const vec3& ray, double maxTime) const;
+
+    // the normal and material of a sphere at a hit on it
+    vec3 normal(int sphere, const vec3& hit) const;
+    inline const Material& material(int sphere) const { return m_materials[m_material[sphere]]; }
+
+    // hashes of the spheres, and of the materials they are given
+    unsigned long long geometryKey() const;
+    unsigned long long materialKey() const;
+
+    virtual bool intersect(const vec3& origin,
+                           const vec3& ray,
+                           double maxTime,
+                           Intersection& result);
+    virtual int pack(Scene& scene);
+    virtual bool bounds(vec3& lo, vec3& hi) const;
+
+private:
+    class GroupVisitor;
+    class AnyGroupVisitor;
+
+    // the closest sphere of a group hit before maxTime, or -1
+    int intersectGroup(int group,
+                       const vec3& origin,
+                       const vec3& ray,
+                       double maxTime,
+                       double& time) const;
+
+    std::vector<float> m_x;
+    std::vector<float> m_y;
+    std::vector<float> m_z;
+    std::vector<float> m_radius;
+    std::vector<unsigned short> m_material;
+    std::vector<Material> m_materials;
+    int m_count;
+
+    ObjectTree m_tree;
+    vec3 m_lo;
+    vec3 m_hi;
+};
+
+#endif // __SPHERESET_H_
@@ -1,9 +1,13 @@
 #include <limits>
 #include <cmath>
 #include <iostream>
+#include <algorithm>
 
 #include "raytracer.h"
+#include "geometry.h"
 #include "surface.h"
+#include "scene.h"
+#include "spheremap.h"
 
 using namespace std;
 
@@ -11,7 +15,9 @@ Intersection::Intersection()
     : m_initialized(false),
       m_time(numeric_limits<double>::infinity()),
       m_hit(vec3()),
-      m_normal(vec3())
+      m_normal(vec3()),
+      m_surface(-1),
+      m_part(-1)
 {
 }
 
@@ -19,6 +25,16 @@ Surface::~Surface()
 {
 }
 
+int Surface::pack(Scene& scene)
+{
+    return scene.addSurface(this);
+}
+
+bool Surface::bounds(vec3& /*lo*/, vec3& /*hi*/) const
+{
+    return false;
+}
+
 Sphere::Sphere(const vec3& location, int radius, const Material& material)
     : m_location(location),
       m_radius(radius),
@@ -31,34 +47,28 @@ bool Sphere::intersect(const vec3& origin,
                        double maxTime,
                        Intersection& result)
 {
-    vec3 l = origin - m_location;
-    double B = 2.0 * ray.dot(l);
-    double C = pow(l.abs(),2) - m_radius * m_radius;
-    double square = B * B  - 4 * C;
-    if (square >= 0) {
-        double root = sqrt(square);
-        double t1 = 0.5 * (-B - root);
-        double t2 = 0.5 * (-B + root);
-
-        result.initialized(false);
-        if (t1 >= EPSILON && t1 <= maxTime) {
-            result.initialized(true);
-            result.time(t1);
-        }
-        else if (t2 >= EPSILON && t2 < maxTime) {
-            result.initialized(true);
-            result.time(t2);
-        }
-
-        if (result.initialized()) {
-            result.hit(origin + result.time() * ray);
-            result.normal((result.hit() - m_location).normalize());
-            result.material(m_material);
-            return true;
-        }
+    double t;
+    if (!intersectSphere(m_location, m_radius, origin, ray, maxTime, t)) {
+        return false;
     }
 
-    return false;
+    result.initialized(true);
+    result.time(t);
+    result.hit(origin + t * ray);
+    result.normal((result.hit() - m_location).normalize());
+    result.material(m_material);
+    return true;
+}
+
+int Sphere::pack(Scene& scene)
+{
+    return scene.addSphere(m_location, m_radius, m_material);
+}
+
+bool Sphere::bounds(vec3& lo, vec3& hi) const
+{
+    sphereBounds(m_location, m_radius, lo, hi);
+    return true;
 }
 
 Planet::Planet(const vec3& location,
@@ -74,7 +84,10 @@ Planet::Planet(const vec3& location,
       m_ambient(ambient),
       m_specular(specular),
       m_img(map),
-      m_theta0(theta0)
+      m_theta0(theta0),
+      m_atmosphere(NULL),
+      m_terrain(NULL),
+      m_terrainHeight(0.0)
 {
 }
 
@@ -87,89 +100,131 @@ bool Planet::intersect(const vec3& origin,
                        double maxTime,
                        Intersection& result)
 {
-    vec3 l = origin - m_location;
-    double B = 2.0 * ray.dot(l);
-    double C = pow(l.abs(),2) - m_radius * m_radius;
-    double square = B * B  - 4 * C;
-    if (square >= 0) {
-        double root = sqrt(square);
-        double t1 = 0.5 * (-B - root);
-        double t2 = 0.5 * (-B + root);
-
-        result.initialized(false);
-        if (t1 >= EPSILON && t1 <= maxTime) {
-            result.initialized(true);
-            result.time(t1);
-        }
-        else if (t2 >= EPSILON && t2 < maxTime) {
-            result.initialized(true);
-            result.time(t2);
+    double t;
+    if (m_terrain != NULL) {
+        if (!m_terrain->intersect(origin - m_location,
+                                  ray,
+                                  m_radius,
+                                  m_terrainHeight,
+                                  m_theta0,
+                                  maxTime,
+                                  t)) {
+            return false;
         }
+    } else if (!intersectSphere(m_location, m_radius, origin, ray, maxTime, t)) {
+        return false;
+    }
 
-        if (result.initialized()) {
-            vec3 hit = origin + result.time() * ray;
-            vec3 pos = hit - m_location;
-            double theta = acos(pos.y() / m_radius);
-            double phi = atan2(pos.z(), pos.x());
-
-            phi = phi + m_theta0;
-            if (phi > M_PI) {
-                phi = phi - 2*M_PI;
-            }
-            else if (phi < -M_PI) {
-                phi = phi + 2*M_PI;
-            }
-
-            int mapWidth = gdImageSX(m_img);
-            int mapHeight = gdImageSY(m_img);
-
-            int mapX = (int)(mapWidth/2.0 - phi*mapWidth/(2.0*M_PI));
-            int mapY = (int)(theta*mapHeight/(M_PI));
-
-            //cout << "theta=" << (theta*180.0/M_PI) << " "
-            //     << "phi=" << (phi*180.0/M_PI) << " "
-            //     << "x=" << mapX << " "
-            //     << "y=" << mapY << endl;
-
-            {
-                int color = gdImageGetPixel(m_img, mapX, mapY);
-                double r = ((color >> 16) & 0xFF) / (double)0xFF;
-                double g = ((color >> 8) & 0xFF) / (double)0xFF;
-                double b = (color & 0xFF) / (double)0xFF;
-
-                m_material.diffuseColor(Color(r, g, b));
-                m_material.highlightColor(Color(r, g, b));
-            }
-
-            if (m_ambient != NULL) {
-                int color = gdImageGetPixel(m_ambient, mapX, mapY);
-                double r = ((color >> 16) & 0xFF) / (double)0xFF;
-                double g = ((color >> 8) & 0xFF) / (double)0xFF;
-                double b = (color & 0xFF) / (double)0xFF;
-
-                m_material.ambientColor(Color(r, g, b));
-            } else {
-                m_material.ambientColor(m_material.diffuseColor());
-            }
-
-            if (m_specular != NULL) {
-                int color = gdImageGetPixel(m_specular, mapX, mapY);
-                double c = (color & 0xFF) / (double)0xFF;
-                m_material.specularWeight(c);
-                m_material.shininess(10.0);
-            } else {
-                m_material.specularWeight(0.0);
-                m_material.shininess(0.0);
-            }
-
-            result.hit(hit);
-            result.normal((result.hit() - m_location).normalize());
-            result.material(m_material);
-            return true;
-        }
+    // the maps are looked up on the sphere under the terrain
+    vec3 hit = origin + t * ray;
+    vec3 pos = hit - m_location;
+    if (m_terrain != NULL) {
+        pos = pos * (m_radius / pos.abs());
     }
 
-    return false;
+    Material material = m_material;
+    mapPlanet(pos,
+              m_radius,
+              m_theta0,
+              m_img,
+              m_ambient,
+              m_specular,
+              material);
+
+    result.initialized(true);
+    result.time(t);
+    result.hit(hit);
+    if (m_terrain != NULL) {
+        result.normal(m_terrain->normal(hit - m_location, m_terrainHeight, m_theta0));
+    } else {
+        result.normal((result.hit() - m_location).normalize());
+    }
+    result.material(material);
+    return true;
+}
+
+int Planet::pack(Scene& scene)
+{
+    return scene.addPlanet(m_location,
+                           m_radius,
+                           m_material,
+                           m_img,
+                           m_ambient,
+                           m_specular,
+                           m_theta0,
+                           m_atmosphere,
+                           m_terrain,
+                           m_terrainHeight);
+}
+
+bool Planet::bounds(vec3& lo, vec3& hi) const
+{
+    sphereBounds(m_location, m_radius + (m_terrain != NULL ? m_terrainHeight : 0.0), lo, hi);
+    return true;
+}
+
+void mapPlanet(const vec3& pos,
+               double radius,
+               double theta0,
+               gdImage* map,
+               gdImage* ambient,
+               gdImage* specular,
+               Material& material)
+{
+    int mapX, mapY;
+    sphereMap(pos.x(),
+              pos.y(),
+              pos.z(),
+              radius,
+              theta0,
+              gdImageSX(map),
+              gdImageSY(map),
+              mapX,
+              mapY);
+
+    //cout << "x=" << mapX << " "
+    //     << "y=" << mapY << endl;
+
+    readPlanetMaps(mapX, mapY, map, ambient, specular, material);
+}
+
+void readPlanetMaps(int mapX,
+                    int mapY,
+                    gdImage* map,
+                    gdImage* ambient,
+                    gdImage* specular,
+                    Material& material)
+{
+    {
+        int color = gdImageGetPixel(map, mapX, mapY);
+        double r = ((color >> 16) & 0xFF) / (double)0xFF;
+        double g = ((color >> 8) & 0xFF) / (double)0xFF;
+        double b = (color & 0xFF) / (double)0xFF;
+
+        material.diffuseColor(Color(r, g, b));
+        material.highlightColor(Color(r, g, b));
+    }
+
+    if (ambient != NULL) {
+        int color = gdImageGetPixel(ambient, mapX, mapY);
+        double r = ((color >> 16) & 0xFF) / (double)0xFF;
+        double g = ((color >> 8) & 0xFF) / (double)0xFF;
+        double b = (color & 0xFF) / (double)0xFF;
+
+        material.ambientColor(Color(r, g, b));
+    } else {
+        material.ambientColor(material.diffuseColor());
+    }
+
+    if (specular != NULL) {
+        int color = gdImageGetPixel(specular, mapX, mapY);
+        double c = (color & 0xFF) / (double)0xFF;
+        material.specularWeight(c);
+        material.shininess(10.0);
+    } else {
+        material.specularWeight(0.0);
+        material.shininess(0.0);
+    }
 }
 
 Plane::Plane(const vec3& normal, const vec3& point, const Material& material)
@@ -184,12 +239,8 @@ bool Plane::intersect(const vec3& origin,
                        double maxTime,
                        Intersection& result)
 {
-    if (ray.dot(m_normal) < EPSILON) {
-        return false;
-    }
-
-    double t = (m_point - origin).dot(m_normal) / ray.dot(m_normal);
-    if (t > maxTime) {
+    double t;
+    if (!intersectPlane(m_normal, m_point, origin, ray, maxTime, t)) {
         return false;
     }
 
@@ -202,6 +253,11 @@ bool Plane::intersect(const vec3& origin,
     return true;
 }
 
+int Plane::pack(Scene& scene)
+{
+    return scene.addPlane(m_normal, m_point, m_material);
+}
+
 Triangle::Triangle(const vec3& location,
                  const vec3& a,
                  const vec3& b,
@@ -212,6 +268,11 @@ Triangle::Triangle(const vec3& location,
       m_material(material)
 {
     m_normal = a.cross(b).normalize();
+
+    m_dotaa = a.dot(a);
+    m_dotab = a.dot(b);
+    m_dotbb = b.dot(b);
+    m_invDenom = 1.0 / (m_dotaa * m_dotbb - m_dotab * m_dotab);
 }
 
 bool Triangle::intersect(const vec3& origin,
@@ -219,38 +280,38 @@ bool Triangle::intersect(const vec3& origin,
                         double maxTime,
                         Intersection& result)
 {
-    if (ray.dot(m_normal) < EPSILON) {
-        return false;
-    }
-
-    double t = (m_location - origin).dot(m_normal) / ray.dot(m_normal);
-    if (t > maxTime) {
+    double t;
+    if (!intersectTriangle(m_location,
+                           m_a,
+                           m_b,
+                           m_normal,
+                           m_dotaa,
+                           m_dotab,
+                           m_dotbb,
+                           m_invDenom,
+                           origin,
+                           ray,
+                           maxTime,
+                           t)) {
         return false;
     }
 
-    vec3 p = origin + t * ray;
-    vec3 c = p - m_location;
-
-    // http://www.blackpawn.com/texts/pointinpoly/
-    double dotaa = m_a.dot(m_a);
-    double dotab = m_a.dot(m_b);
-    double dotac = m_a.dot(c);
-    double dotbb = m_b.dot(m_b);
-    double dotbc = m_b.dot(c);
-
-    double invDenom = 1.0 / (dotaa * dotbb - dotab * dotab);
-    double u = (dotbb * dotac - dotab * dotbc) * invDenom;
-    double v = (dotaa * dotbc - dotab * dotac) * invDenom;
+    result.initialized(true);
+    result.time(t);
+    result.hit(origin + t * ray);
+    result.normal(m_normal);
+    result.material(m_material);
 
-    if (u >= 0.0 && v >= 0.0 && u + v < 1.0) {
-        result.initialized(true);
-        result.time(t);
-        result.hit(p);
-        result.normal(m_normal);
-        result.material(m_material);
+    return true;
+}
 
-        return true;
-    }
+int Triangle::pack(Scene& scene)
+{
+    return scene.addTriangle(m_location, m_a, m_b, m_normal, m_material);
+}
 
-    return false;
+bool Triangle::bounds(vec3& lo, vec3& hi) const
+{
+    triangleBounds(m_location, m_a, m_b, lo, hi);
+    return true;
 }
@@ -24,14 +24,29 @@ public:
     inline const Material& material() const { return m_material; }
     inline void material(const Material& material) { m_material = material; }
 
+    // id of the surface that was hit, as assigned by the scene
+    inline int surface() const { return m_surface; }
+    inline void surface(int surface) { m_surface = surface; }
+
+    // the part of a surface made of many that was hit, such as a sphere
+    // of a SphereSet, or -1
+    inline int part() const { return m_part; }
+    inline void part(int part) { m_part = part; }
+
 private:
     bool m_initialized;
     double m_time;
     vec3 m_hit;
     vec3 m_normal;
     Material m_material;
+    int m_surface;
+    int m_part;
 };
 
+class Scene;
+class Atmosphere;
+class Heightfield;
+
 class Surface {
 public:
     virtual ~Surface();
@@ -40,6 +55,15 @@ public:
                            const vec3& ray,
                            double maxTime,
                            Intersection& result) = 0;
+
+    // add this surface to the storage of a scene and return its id. by
+    // default the scene refers to the surface itself, which must then
+    // outlive the scene; the primitive shapes are copied instead.
+    virtual int pack(Scene& scene);
+
+    // the box around the surface. false if it is unbounded, which is the
+    // default.
+    virtual bool bounds(vec3& lo, vec3& hi) const;
 };
 
 class Sphere : public Surface {
@@ -50,6 +74,8 @@ public:
                            const vec3& ray,
                            double maxTime,
                            Intersection& result);
+    virtual int pack(Scene& scene);
+    virtual bool bounds(vec3& lo, vec3& hi) const;
 private:
     vec3 m_location;
     int m_radius;
@@ -71,6 +97,21 @@ public:
                            const vec3& ray,
                            double maxTime,
                            Intersection& result);
+    virtual int pack(Scene& scene);
+    virtual bool bounds(vec3& lo, vec3& hi) const;
+
+    // the atmosphere around the planet, or NULL for none
+    inline const Atmosphere* atmosphere() const { return m_atmosphere; }
+    inline void atmosphere(const Atmosphere* atmosphere) { m_atmosphere = atmosphere; }
+
+    // the terrain over the planet, whose white ground is height above
+    // its radius, or NULL for a smooth sphere
+    inline const Heightfield* terrain() const { return m_terrain; }
+    inline double terrainHeight() const { return m_terrainHeight; }
+    inline void terrain(const Heightfield* terrain, double height) {
+        m_terrain = terrain;
+        m_terrainHeight = height;
+    }
 private:
     vec3 m_location;
     int m_radius;
@@ -79,6 +120,9 @@ private:
     gdImage* m_specular;
     gdImage* m_img;
     double m_theta0;
+    const Atmosphere* m_atmosphere;
+    const Heightfield* m_terrain;
+    double m_terrainHeight;
 };
 
 class Plane : public Surface {
@@ -89,6 +133,7 @@ public:
                            const vec3& ray,
                            double maxTime,
                            Intersection& result);
+    virtual int pack(Scene& scene);
 private:
     vec3 m_normal;
     vec3 m_point;
@@ -103,12 +148,36 @@ public:
                            const vec3& ray,
                            double maxTime,
                            Intersection& result);
+    virtual int pack(Scene& scene);
+    virtual bool bounds(vec3& lo, vec3& hi) const;
 private:
     vec3 m_location;
     vec3 m_a;
     vec3 m_b;
     vec3 m_normal;
+    double m_dotaa;
+    double m_dotab;
+    double m_dotbb;
+    double m_invDenom;
     Material m_material;
 };
 
+// look up the maps of a planet for a point on its surface, given relative
+// to its center, and store the colors in material
+void mapPlanet(const vec3& pos,
+               double radius,
+               double theta0,
+               gdImage* map,
+               gdImage* ambient,
+               gdImage* specular,
+               Material& material);
+
+// read the maps of a planet at a pixel of the maps into material
+void readPlanetMaps(int mapX,
+                    int mapY,
+                    gdImage* map,
+                    gdImage* ambient,
+                    gdImage* specular,
+                    Material& material);
+
 #endif // __SURFACE_H_
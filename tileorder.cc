@@ -0,0 +1,96 @@
+#include <algorithm>
+#include <cstring>
+#include <utility>
+
+#include "tileorder.h"
+
+using namespace std;
+
+// spread the low 32 bits of v so that there is a zero bit between each
+static unsigned long long spreadBits(unsigned long long v)
+{
+    v &= 0xFFFFFFFFULL;
+    v = (v | (v << 16)) & 0x0000FFFF0000FFFFULL;
+    v = (v | (v << 8)) & 0x00FF00FF00FF00FFULL;
+    v = (v | (v << 4)) & 0x0F0F0F0F0F0F0F0FULL;
+    v = (v | (v << 2)) & 0x3333333333333333ULL;
+    v = (v | (v << 1)) & 0x5555555555555555ULL;
+    return v;
+}
+
+unsigned long long mortonIndex(unsigned int x, unsigned int y)
+{
+    return spreadBits(x) | (spreadBits(y) << 1);
+}
+
+unsigned long long hilbertIndex(unsigned int side, unsigned int x, unsigned int y)
+{
+    // descend through the quadrants, turning the coordinates into the frame
+    // of the curve inside each
+    unsigned long long d = 0;
+    for (unsigned int s = side / 2; s > 0; s /= 2) {
+        unsigned int rx = (x & s) ? 1 : 0,
+                     ry = (y & s) ? 1 : 0;
+        d += (unsigned long long)s * s * ((3 * rx) ^ ry);
+
+        if (ry == 0) {
+            if (rx == 1) {
+                x = side - 1 - x;
+                y = side - 1 - y;
+            }
+            swap(x, y);
+        }
+    }
+    return d;
+}
+
+vector<int> orderTiles(int width, int height, TileOrder order)
+{
+    unsigned int side = 1;
+    while (side < (unsigned int)width || side < (unsigned int)height) {
+        side *= 2;
+    }
+
+    vector<pair<unsigned long long, int> > keys;
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            unsigned long long key;
+            switch (order) {
+            case TILE_MORTON:
+                key = mortonIndex(x, y);
+                break;
+            case TILE_HILBERT:
+                key = hilbertIndex(side, x, y);
+                break;
+            default:
+                key = (unsigned long long)y * width + x;
+                break;
+            }
+            keys.push_back(make_pair(key, y * width + x));
+        }
+    }
+    sort(keys.begin(), keys.end());
+
+    vector<int> tiles;
+    for (vector<pair<unsigned long long, int> >::iterator key = keys.begin();
+         key != keys.end();
+         key++) {
+
+        tiles.push_back(key->second);
+    }
+    return tiles;
+}
+
+bool parseTileOrder(const char* name, TileOrder& order)
+{
+    if (strcmp(name, "rows") == 0) {
+        order = TILE_ROWS;
+    } else if (strcmp(name, "morton") == 0) {
+        order = TILE_MORTON;
+    } else if (strcmp(name, "hilbert") == 0) {
+        order = TILE_HILBERT;
+    } else {
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,32 @@
+#ifndef __TILEORDER_H_
+#define __TILEORDER_H_
+
+#include <vector>
+
+// The order in which the tiles of an image are handed to the workers.
+// Tiles in row order sweep across the whole image before coming back next
+// to where they started, so the objects and texels seen by a tile have
+// long left the caches by the time its neighbour below is traced. The
+// space filling curves keep consecutive tiles close in both directions:
+// the Z-shaped Morton curve of the interleaved bits of x and y, and the
+// Hilbert curve, whose consecutive tiles always share an edge.
+enum TileOrder {
+    TILE_ROWS,
+    TILE_MORTON,
+    TILE_HILBERT
+};
+
+// the tiles of a grid of width x height tiles, as y * width + x, in the
+// given order. grids that are not square powers of two follow the curve
+// of the square around them, skipping the tiles outside the grid.
+std::vector<int> orderTiles(int width, int height, TileOrder order);
+
+// the position of tile (x, y) along the Morton or Hilbert curve through a
+// square of side tiles, which is a power of two
+unsigned long long mortonIndex(unsigned int x, unsigned int y);
+unsigned long long hilbertIndex(unsigned int side, unsigned int x, unsigned int y);
+
+// parse rows, morton or hilbert. false for any other name.
+bool parseTileOrder(const char* name, TileOrder& order);
+
+#endif // __TILEORDER_H_
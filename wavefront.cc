@@ -0,0 +1,303 @@
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#include "raytracer.h"
+#include "wavefront.h"
+#include "profiler.h"
+
+using namespace std;
+
+// side of the cells that ray origins and hits are sorted by
+#define WAVEFRONT_CELL_SIZE 4.0
+
+// spread the low 21 bits of v so that there are two zero bits between each
+static unsigned long long spreadBits(unsigned long long v)
+{
+    v &= 0x1FFFFF;
+    v = (v | (v << 32)) & 0x1F00000000FFFFULL;
+    v = (v | (v << 16)) & 0x1F0000FF0000FFULL;
+    v = (v | (v << 8)) & 0x100F00F00F00F00FULL;
+    v = (v | (v << 4)) & 0x10C30C30C30C30C3ULL;
+    v = (v | (v << 2)) & 0x1249249249249249ULL;
+    return v;
+}
+
+static unsigned long long octant(const vec3& d)
+{
+    return (d.x() < 0 ? 1 : 0) | (d.y() < 0 ? 2 : 0) | (d.z() < 0 ? 4 : 0);
+}
+
+WavefrontRenderer::WavefrontRenderer(const Renderer& renderer)
+    : m_renderer(renderer)
+{
+}
+
+unsigned long long WavefrontRenderer::cell(const vec3& p) const
+{
+    // morton code of the cell, so that nearby cells sort close together
+    double offset = (1 << 20) * WAVEFRONT_CELL_SIZE;
+    unsigned long long x = (unsigned long long)max(0.0, (p.x() + offset) / WAVEFRONT_CELL_SIZE),
+                       y = (unsigned long long)max(0.0, (p.y() + offset) / WAVEFRONT_CELL_SIZE),
+                       z = (unsigned long long)max(0.0, (p.z() + offset) / WAVEFRONT_CELL_SIZE);
+
+    return spreadBits(x) | (spreadBits(y) << 1) | (spreadBits(z) << 2);
+}
+
+void WavefrontRenderer::render(Framebuffer& framebuffer,
+                               int x0,
+                               int y0,
+                               int x1,
+                               int y1,
+                               ShadowCache& shadowCache,
+                               Dependencies* dependencies)
+{
+    const RenderSettings& settings = m_renderer.settings();
+    int samples = m_renderer.sampleCount();
+    int width = x1 - x0;
+
+    generateRays(x0, y0, x1, y1);
+    for (int k = 0; k < settings.maxReflectionSteps && !m_queue.empty(); k++) {
+        intersectRays(k == 0);
+        shadeHits(k == 0 && framebuffer.hasFeatures(), dependencies);
+        traceShadowRays(shadowCache);
+        shadeLights();
+        reflectRays();
+    }
+
+    // sum the samples of every pixel in sample order
+    for (int y = y0; y < y1; y++) {
+        for (int x = x0; x < x1; x++) {
+            int first = ((y - y0) * width + (x - x0)) * samples;
+
+            Color pixel;
+            PixelFeatures features;
+            for (int sample = 0; sample < samples; sample++) {
+                pixel += m_paths[first + sample].radiance;
+                features.add(m_paths[first + sample].features);
+            }
+
+            framebuffer.at(x, y) = m_renderer.pixelColor(pixel);
+            if (framebuffer.hasFeatures()) {
+                features.average(samples);
+                framebuffer.features(x, y) = features;
+            }
+        }
+    }
+}
+
+void WavefrontRenderer::generateRays(int x0, int y0, int x1, int y1)
+{
+    const RenderSettings& settings = m_renderer.settings();
+    int samples = m_renderer.sampleCount();
+    int width = x1 - x0, height = y1 - y0;
+
+    // the camera ray of every sample
+    m_paths.resize(width * height * samples);
+    m_hits.resize(m_paths.size());
+    m_queue.clear();
+    for (int y = y0; y < y1; y++) {
+        for (int x = x0; x < x1; x++) {
+            for (int sample = 0; sample < samples; sample++) {
+                int index = ((y - y0) * width + (x - x0)) * samples + sample;
+
+                Path& path = m_paths[index];
+                path.x = x;
+                path.y = y;
+                path.sample = sample;
+                path.stream = m_renderer.sampleStream(x, y, sample);
+                path.ray = m_renderer.cameraRay(x, y, sample, path.stream);
+                path.origin = m_renderer.camera().eye();
+                path.throughput = vec3(settings.radianceScale,
+                                       settings.radianceScale,
+                                       settings.radianceScale);
+                path.radiance = Color();
+                path.features = PixelFeatures();
+
+                m_queue.push_back(index);
+            }
+        }
+    }
+}
+
+void WavefrontRenderer::intersectRays(bool firstHits)
+{
+    // sort the rays by origin and direction
+    ProfileScope sortProfile(PROFILE_SORT, m_queue.size());
+    m_keys.clear();
+    for (vector<int>::iterator index = m_queue.begin();
+         index != m_queue.end();
+         index++) {
+
+        const Path& path = m_paths[*index];
+        unsigned long long key = (octant(path.ray) << 61)
+                               | (cell(path.origin) & 0x1FFFFFFFFFFFFFFFULL);
+        m_keys.push_back(SortKey(key, *index));
+    }
+    sort(m_keys.begin(), m_keys.end());
+    sortProfile.end();
+
+    // find the closest hits, and drop the rays that leave the scene. the
+    // camera rays may find theirs in the g-buffer. every ray passes through
+    // the atmospheres up to its hit, or out of the scene.
+    m_queue.clear();
+    for (vector<SortKey>::iterator key = m_keys.begin();
+         key != m_keys.end();
+         key++) {
+
+        Path& path = m_paths[key->second];
+        Intersection& hit = m_hits[key->second];
+        hit = Intersection();
+        bool found = firstHits
+                   ? m_renderer.primaryHit(path.x, path.y, path.sample, path.ray, hit)
+                   : m_renderer.intersect(path.origin, path.ray, hit);
+        m_renderer.shadeAtmosphere(path.origin,
+                                   path.ray,
+                                   found ? hit.time() : numeric_limits<double>::infinity(),
+                                   path.throughput,
+                                   path.radiance);
+        if (found) {
+            m_queue.push_back(key->second);
+        }
+    }
+
+    // sort the hits by surface and position for the material lookups
+    ProfileScope hitSortProfile(PROFILE_SORT, m_queue.size());
+    m_keys.clear();
+    for (vector<int>::iterator index = m_queue.begin();
+         index != m_queue.end();
+         index++) {
+
+        const Intersection& hit = m_hits[*index];
+        unsigned long long key = ((unsigned long long)hit.surface() << 40)
+                               | (cell(hit.hit()) & 0xFFFFFFFFFFULL);
+        m_keys.push_back(SortKey(key, *index));
+    }
+    sort(m_keys.begin(), m_keys.end());
+
+    for (size_t i = 0; i < m_keys.size(); i++) {
+        m_queue[i] = m_keys[i].second;
+    }
+}
+
+void WavefrontRenderer::shadeHits(bool firstHits, Dependencies* dependencies)
+{
+    // look up the materials, which for planets reads their maps
+    if (!m_queue.empty()) {
+        m_renderer.applyMaterials(&m_hits[0], &m_queue[0], m_queue.size());
+    }
+
+    // ambient light, and the lights to test for every hit
+    m_shadowRays.clear();
+    LightSample lights[MAX_LIGHT_SAMPLES];
+    for (vector<int>::iterator index = m_queue.begin();
+         index != m_queue.end();
+         index++) {
+
+        Path& path = m_paths[*index];
+        Intersection& hit = m_hits[*index];
+        if (firstHits) {
+            path.features = m_renderer.sampleFeatures(hit);
+        }
+        if (dependencies != NULL) {
+            dependencies->addSurface(hit.surface());
+        }
+
+        m_renderer.shadeAmbient(path.ray, path.throughput, hit, path.radiance);
+
+        int count = m_renderer.sampleLights(hit, path.stream, lights, dependencies);
+        for (int i = 0; i < count; i++) {
+            ShadowRay shadowRay;
+            shadowRay.path = *index;
+            shadowRay.light = lights[i];
+            shadowRay.visible = false;
+            m_shadowRays.push_back(shadowRay);
+        }
+    }
+}
+
+void WavefrontRenderer::traceShadowRays(ShadowCache& shadowCache)
+{
+    // trace the shadow rays grouped by light and direction
+    ProfileScope sortProfile(PROFILE_SORT, m_shadowRays.size());
+    m_keys.clear();
+    for (size_t i = 0; i < m_shadowRays.size(); i++) {
+        const ShadowRay& shadowRay = m_shadowRays[i];
+        unsigned long long key = ((unsigned long long)shadowRay.light.light << 48)
+                               | (octant(shadowRay.light.direction) << 45)
+                               | (cell(m_hits[shadowRay.path].hit()) & 0x1FFFFFFFFFFFULL);
+        m_keys.push_back(SortKey(key, i));
+    }
+    sort(m_keys.begin(), m_keys.end());
+    sortProfile.end();
+
+    for (vector<SortKey>::iterator key = m_keys.begin();
+         key != m_keys.end();
+         key++) {
+
+        ShadowRay& shadowRay = m_shadowRays[key->second];
+        shadowRay.visible = m_renderer.visible(m_hits[shadowRay.path],
+                                               shadowRay.light,
+                                               shadowCache);
+    }
+}
+
+void WavefrontRenderer::shadeLights()
+{
+    // group the visible lights by the shading kernel of their material,
+    // keeping the order the shadow rays were created in within a group.
+    // that keeps the lights of every path in the order the recursive path
+    // adds them.
+    ProfileScope sortProfile(PROFILE_SORT, m_shadowRays.size());
+    m_keys.clear();
+    for (size_t i = 0; i < m_shadowRays.size(); i++) {
+        const ShadowRay& shadowRay = m_shadowRays[i];
+        if (shadowRay.visible) {
+            unsigned long long kernel = shadingKernel(m_hits[shadowRay.path].material());
+            m_keys.push_back(SortKey((kernel << 40) | i, i));
+        }
+    }
+    sort(m_keys.begin(), m_keys.end());
+    sortProfile.end();
+
+    m_lights.resize(m_keys.size());
+    for (size_t i = 0; i < m_keys.size(); i++) {
+        const ShadowRay& shadowRay = m_shadowRays[m_keys[i].second];
+        Path& path = m_paths[shadowRay.path];
+        LightShading& light = m_lights[i];
+        light.ray = &path.ray;
+        light.throughput = &path.throughput;
+        light.hit = &m_hits[shadowRay.path];
+        light.sample = &shadowRay.light;
+        light.radiance = &path.radiance;
+    }
+
+    // and shade every group in one batch
+    size_t first = 0;
+    while (first < m_keys.size()) {
+        unsigned long long kernel = m_keys[first].first >> 40;
+        size_t last = first + 1;
+        while (last < m_keys.size() && m_keys[last].first >> 40 == kernel) {
+            last++;
+        }
+
+        m_renderer.shadeLights(kernel, &m_lights[first], last - first);
+        first = last;
+    }
+}
+
+void WavefrontRenderer::reflectRays()
+{
+    vector<int>::iterator last = m_queue.begin();
+    for (vector<int>::iterator index = m_queue.begin();
+         index != m_queue.end();
+         index++) {
+
+        Path& path = m_paths[*index];
+        if (m_renderer.reflect(m_hits[*index], path.throughput, path.origin, path.ray)) {
+            *last++ = *index;
+        }
+    }
+
+    m_queue.erase(last, m_queue.end());
+}
@@ -0,0 +1,85 @@
+#ifndef __WAVEFRONT_H_
+#define __WAVEFRONT_H_
+
+#include <vector>
+#include <utility>
+
+#include "vec3.h"
+#include "color.h"
+#include "random.h"
+#include "surface.h"
+#include "renderer.h"
+
+// An integrator that traces all samples of a block of pixels together, one
+// stage at a time: closest hits for every queued ray, then the materials of
+// every hit, then shading, then every shadow ray, then the reflected rays
+// for the next round. Between stages the queued rays are sorted by origin
+// cell and direction octant, the hits by surface and position and the
+// shadow rays by light and direction, so that each stage walks geometry
+// and textures in a coherent order. The visible lights are then grouped by
+// the shading kernel of their materials, and each group is shaded in one
+// batch.
+//
+// It runs the steps of Renderer on the same random numbers and sums the
+// radiance of every path in the same order, so the image is identical to
+// the one of Renderer::render.
+class WavefrontRenderer {
+public:
+    WavefrontRenderer(const Renderer& renderer);
+
+    // trace all samples of the pixels in [x0, x1) x [y0, y1). if
+    // dependencies is given, the surfaces and lights the paths touch are
+    // added to it.
+    void render(Framebuffer& framebuffer,
+                int x0,
+                int y0,
+                int x1,
+                int y1,
+                ShadowCache& shadowCache,
+                Dependencies* dependencies = NULL);
+
+private:
+    typedef std::pair<unsigned long long, int> SortKey;
+
+    struct Path {
+        // the sample the path was started for
+        int x;
+        int y;
+        int sample;
+        SampleStream stream;
+        vec3 origin;
+        vec3 ray;
+        vec3 throughput;
+        Color radiance;
+        PixelFeatures features;
+    };
+
+    struct ShadowRay {
+        int path;
+        LightSample light;
+        bool visible;
+    };
+
+    void generateRays(int x0, int y0, int x1, int y1);
+    void intersectRays(bool firstHits);
+    void shadeHits(bool firstHits, Dependencies* dependencies);
+    void traceShadowRays(ShadowCache& shadowCache);
+    void shadeLights();
+    void reflectRays();
+
+    unsigned long long cell(const vec3& p) const;
+
+    const Renderer& m_renderer;
+
+    std::vector<Path> m_paths;
+    std::vector<Intersection> m_hits;
+    std::vector<ShadowRay> m_shadowRays;
+    std::vector<LightShading> m_lights;
+
+    // indices of the paths still being traced, and of the shadow rays, in
+    // the order the next stage processes them
+    std::vector<int> m_queue;
+    std::vector<SortKey> m_keys;
+};
+
+#endif // __WAVEFRONT_H_
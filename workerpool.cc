@@ -0,0 +1,98 @@
+#include "workerpool.h"
+
+using namespace std;
+
+// the index of the worker running on this thread
+static thread_local int s_worker = 0;
+
+Task::~Task()
+{
+}
+
+WorkerPool::WorkerPool(int threads)
+    : m_task(NULL),
+      m_count(0),
+      m_next(0),
+      m_active(0),
+      m_stop(false)
+{
+    if (threads <= 0) {
+        threads = thread::hardware_concurrency();
+    }
+
+    for (int i = 1; i < threads; i++) {
+        m_workers.push_back(thread(&WorkerPool::work, this, i));
+    }
+}
+
+WorkerPool::~WorkerPool()
+{
+    {
+        unique_lock<mutex> lock(m_mutex);
+        m_stop = true;
+    }
+    m_wake.notify_all();
+
+    for (vector<thread>::iterator worker = m_workers.begin();
+         worker != m_workers.end();
+         worker++) {
+
+        worker->join();
+    }
+}
+
+void WorkerPool::run(Task& task, int count)
+{
+    unique_lock<mutex> lock(m_mutex);
+    m_task = &task;
+    m_count = count;
+    m_next = 0;
+    m_wake.notify_all();
+
+    process(lock);
+
+    // wait for the items other threads are still working on
+    while (m_active > 0) {
+        m_done.wait(lock);
+    }
+    m_task = NULL;
+}
+
+int WorkerPool::worker()
+{
+    return s_worker;
+}
+
+void WorkerPool::work(int index)
+{
+    s_worker = index;
+
+    unique_lock<mutex> lock(m_mutex);
+    while (!m_stop) {
+        if (m_task != NULL && m_next < m_count) {
+            process(lock);
+        } else {
+            m_wake.wait(lock);
+        }
+    }
+}
+
+void WorkerPool::process(unique_lock<mutex>& lock)
+{
+    // hand out items one at a time, so that uneven items balance out
+    while (m_task != NULL && m_next < m_count) {
+        Task* task = m_task;
+        int index = m_next++;
+        m_active++;
+
+        lock.unlock();
+        task->run(index);
+        lock.lock();
+
+        m_active--;
+    }
+
+    if (m_active == 0) {
+        m_done.notify_all();
+    }
+}
@@ -0,0 +1,56 @@
+#ifndef __WORKERPOOL_H_
+#define __WORKERPOOL_H_
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+// A unit of parallel work, split into a number of independent items
+class Task {
+public:
+    virtual ~Task();
+
+    // process item index. called concurrently from several threads.
+    virtual void run(int index) = 0;
+};
+
+// A fixed set of threads that process the items of one task at a time.
+// The calling thread works on the task as well, so a pool with no extra
+// threads runs everything serially.
+class WorkerPool {
+public:
+    // start threads - 1 workers, or one per hardware thread if threads is 0
+    WorkerPool(int threads = 0);
+    ~WorkerPool();
+
+    inline int threads() const { return m_workers.size() + 1; }
+
+    // index in [0, threads()) of the thread that calls this from run of a
+    // task, so that tasks can keep state per thread. the thread that runs
+    // the task is 0.
+    static int worker();
+
+    // run items [0, count) of the task and wait until all are done
+    void run(Task& task, int count);
+
+private:
+    WorkerPool(const WorkerPool&);
+    WorkerPool& operator=(const WorkerPool&);
+
+    void work(int index);
+    void process(std::unique_lock<std::mutex>& lock);
+
+    std::vector<std::thread> m_workers;
+    std::mutex m_mutex;
+    std::condition_variable m_wake;
+    std::condition_variable m_done;
+
+    Task* m_task;
+    int m_count;
+    int m_next;
+    int m_active;
+    bool m_stop;
+};
+
+#endif // __WORKERPOOL_H_